@@ -14,7 +14,7 @@ layout(location = 1) out vec4 outNormal;
 layout(location = 2) out vec4 outColor;
 layout(location = 3) out vec4 outMaterial;
 
-layout(binding = 2) uniform MaterialInfo {
+struct Material {
     float ambient;
     float diffuse;
     float specular;
@@ -22,11 +22,21 @@ layout(binding = 2) uniform MaterialInfo {
 
     float texture;
     float normal;
-    float param2;
-    float param3;
-} materialInfo;
+    float textureBucket;
+    float normalBucket;
+};
 
-layout(binding = 3) uniform sampler2DArray tex;
+layout(std430, binding = 2) readonly buffer MaterialBuffer {
+    Material materials[];
+};
+
+layout(push_constant) uniform DrawInfo {
+    uint transIndex;
+    uint materialIndex;
+} draw;
+
+// One texture array per size bucket (128, 256, 512, 1024, 2048)
+layout(binding = 3) uniform sampler2DArray tex[5];
 
 layout(binding = 4) uniform DepthOfField {
     float dofEnable;
@@ -42,14 +52,28 @@ layout(binding = 4) uniform DepthOfField {
     vec4 taps[50];
 } dofInfo;
 
+// Bucket is uniform per draw, constant indices keep this valid
+// without dynamic sampler array indexing
+vec4 sampleBucket(float bucket, vec3 uv) {
+    switch (int(bucket)) {
+    case 0: return texture(tex[0], uv);
+    case 1: return texture(tex[1], uv);
+    case 2: return texture(tex[2], uv);
+    case 3: return texture(tex[3], uv);
+    default: return texture(tex[4], uv);
+    }
+}
+
 // circle of confusion
 float coc(float depth) {
     return smoothstep(0, dofInfo.focalWidth, abs(dofInfo.focalDistance - depth));
 }
 
 void main() {
-    vec4 objColor = texture(tex, vec3(vert.uv, materialInfo.texture));
-    vec3 normalsFromTexture = texture(tex, vec3(vert.uv, materialInfo.normal)).rgb;
+    Material materialInfo = materials[draw.materialIndex];
+
+    vec4 objColor = sampleBucket(materialInfo.textureBucket, vec3(vert.uv, materialInfo.texture));
+    vec3 normalsFromTexture = sampleBucket(materialInfo.normalBucket, vec3(vert.uv, materialInfo.normal)).rgb;
 
     if(dofInfo.param0 > 1.5) {
         outNormal.xy = normalize((normalsFromTexture * 2.0 - 1.0) * vert.normal).xy;
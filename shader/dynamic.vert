@@ -17,21 +17,32 @@ layout(binding = 0) uniform GlobalTransformations {
 	mat4 view;
 } globalTrans;
 
-layout(binding = 1) uniform ModelTransformations {
+struct ModelTransformations {
 	mat4 model;
 	mat4 normalMatrix;
-} modelTrans;
+};
+
+layout(std430, binding = 1) readonly buffer ModelTransformationBuffer {
+	ModelTransformations modelTrans[];
+};
+
+layout(push_constant) uniform DrawInfo {
+	uint transIndex;
+	uint materialIndex;
+} draw;
 
 out gl_PerVertex {
 	vec4 gl_Position;
 };
 
 void main() {
-	vec4 worldSpace = modelTrans.model * vec4(inPosition, 1.);
+	ModelTransformations trans = modelTrans[draw.transIndex];
+
+	vec4 worldSpace = trans.model * vec4(inPosition, 1.);
 	vec4 viewPos    = globalTrans.view * worldSpace;
 
 	vert.position    = worldSpace.xyz;
-	vert.normal      = normalize(mat3(modelTrans.normalMatrix) * inNormal);
+	vert.normal      = normalize(mat3(trans.normalMatrix) * inNormal);
 	vert.uv          = inUv;
 	vert.linearDepth = -viewPos.z;
 
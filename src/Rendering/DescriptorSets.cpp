@@ -66,6 +66,21 @@ void DescriptorSets::update (
     vkUpdateDescriptorSets (device, 1, &write, 0, nullptr);
 }
 
+void DescriptorSets::update (
+    Set set,
+    uint32_t binding,
+    const std::vector<VkDescriptorImageInfo> &infos
+) const {
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSets[static_cast<size_t>(set)];
+    write.dstBinding = binding;
+    write.descriptorCount = static_cast<uint32_t>(infos.size ());
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = infos.data ();
+    vkUpdateDescriptorSets (device, 1, &write, 0, nullptr);
+}
+
 VkDescriptorSet DescriptorSets::set (
     Set s
 ) const {
@@ -88,12 +103,13 @@ void DescriptorSets::addLayout (
     std::vector<VkDescriptorSetLayoutBinding> &layout,
     uint32_t binding,
     VkDescriptorType type,
-    VkShaderStageFlags stage
+    VkShaderStageFlags stage,
+    uint32_t count
 ) const {
     VkDescriptorSetLayoutBinding b = {};
     b.binding = binding;
     b.descriptorType = type;
-    b.descriptorCount = 1;
+    b.descriptorCount = count;
     b.stageFlags = stage;
     layout.push_back (b);
 }
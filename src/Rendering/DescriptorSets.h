@@ -25,6 +25,7 @@ class DescriptorSets {
   void allocate(VkDescriptorPool pool);
   void update(Set set, uint32_t binding, VkDescriptorType type, VkDescriptorBufferInfo info) const;
   void update(Set set, uint32_t binding, VkDescriptorImageInfo info) const;
+  void update(Set set, uint32_t binding, const std::vector<VkDescriptorImageInfo> &infos) const;
   VkDescriptorSet set(Set s) const;
   VkDescriptorSetLayout layout(Set s) const;
   const std::unordered_map<VkDescriptorType, uint32_t> &requirements() const;
@@ -41,7 +42,8 @@ class DescriptorSets {
       std::vector<VkDescriptorSetLayoutBinding> &layout,
       uint32_t binding,
       VkDescriptorType type,
-      VkShaderStageFlags stage
+      VkShaderStageFlags stage,
+      uint32_t count = 1
   ) const;
 };
 
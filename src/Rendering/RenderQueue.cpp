@@ -0,0 +1,160 @@
+#include <algorithm>
+
+#include "Common/ErrorHandling.h"
+#include "Rendering/RenderQueue.h"
+#include "jojo_pipeline.hpp"
+
+namespace Rendering {
+
+static const uint32_t indexBits     = 24;
+static const uint32_t lowShift      = 24;
+static const uint32_t highShift     = 40;
+static const uint32_t depthMax      = 0xFFFF;
+static const uint32_t materialMax   = 0xFFFF;
+static const uint32_t pipelineShift = 56;
+static const uint32_t pipelineMax   = 0x3F;
+static const uint32_t passShift     = 62;
+
+uint32_t RenderQueue::addPipeline (
+    const PipelineState &state
+) {
+    CHECK (pipelines.size () <= pipelineMax, "Too many render queue pipelines");
+    pipelines.push_back (state);
+    return static_cast<uint32_t>(pipelines.size () - 1);
+}
+
+void RenderQueue::clear ()
+{
+    packets.clear ();
+    keys.clear ();
+}
+
+void RenderQueue::push (
+    Pass pass,
+    uint32_t pipeline,
+    float depth,
+    const DrawPacket &packet
+) {
+    const auto index = static_cast<uint64_t>(packets.size ());
+    CHECK (index < (1u << indexBits), "Render queue is full");
+
+    depth = std::min (std::max (depth, 0.0f), 1.0f);
+    const auto depthBucket = static_cast<uint64_t>(depth * depthMax);
+    const auto material    = std::min<uint64_t> (packet.materialIndex, materialMax);
+
+    // Transparent draws are blended back to front, depth has to
+    // outrank the material
+    auto high = material;
+    auto low  = depthBucket;
+    if (pass == Pass::Transparent) {
+        high = depthMax - depthBucket;
+        low  = material;
+    }
+
+    const uint64_t key =
+        (static_cast<uint64_t>(pass) << passShift)
+        | (static_cast<uint64_t>(pipeline) << pipelineShift)
+        | (high << highShift)
+        | (low << lowShift)
+        | index;
+
+    packets.push_back (packet);
+    keys.push_back (key);
+}
+
+void RenderQueue::sort ()
+{
+    const auto count = keys.size ();
+    if (count < 2)
+        return;
+
+    scratch.resize (count);
+    uint64_t *src = keys.data ();
+    uint64_t *dst = scratch.data ();
+
+    // LSD radix sort, one byte per pass. The low bits are the packet
+    // index, which is already in order, and stability keeps it that way.
+    for (uint32_t shift = indexBits; shift < 64; shift += 8) {
+        uint32_t histogram[256] = {};
+
+        for (size_t i = 0; i < count; ++i)
+            histogram[(src[i] >> shift) & 0xFF] += 1;
+
+        // Every key has the same digit, nothing to do for this byte
+        if (histogram[(src[0] >> shift) & 0xFF] == count)
+            continue;
+
+        uint32_t offset = 0;
+        for (auto &bucket : histogram) {
+            const auto bucketCount = bucket;
+            bucket  = offset;
+            offset += bucketCount;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            dst[histogram[(src[i] >> shift) & 0xFF]++] = src[i];
+
+        std::swap (src, dst);
+    }
+
+    if (src != keys.data ())
+        keys.swap (scratch);
+}
+
+void RenderQueue::cmdSubmit (
+    VkCommandBuffer cmd,
+    Pass pass
+) const {
+    const auto passBegin = static_cast<uint64_t>(pass) << passShift;
+    const auto passEnd   = passBegin + (1ull << passShift) - 1;
+    const auto begin = std::lower_bound (keys.begin (), keys.end (), passBegin);
+    const auto end   = std::upper_bound (begin, keys.end (), passEnd);
+
+    // Only bind state when the pipeline part of the key changes,
+    // everything else per draw fits into the push constants
+    uint32_t currentPipeline = pipelineMax + 1;
+    const PipelineState *state = nullptr;
+
+    for (auto it = begin; it != end; ++it) {
+        const auto key      = *it;
+        const auto pipeline = static_cast<uint32_t>((key >> pipelineShift) & pipelineMax);
+        const auto &packet  = packets[key & ((1u << indexBits) - 1)];
+
+        if (pipeline != currentPipeline) {
+            currentPipeline = pipeline;
+            state = &pipelines[pipeline];
+
+            vkCmdBindPipeline (
+                cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                state->pipeline->pipeline
+            );
+            vkCmdBindDescriptorSets (
+                cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                state->pipeline->pipelineLayout,
+                0, 1, &state->descriptorSet, 0, nullptr
+            );
+        }
+
+        const uint32_t indices[] = {
+            packet.transIndex,
+            packet.materialIndex
+        };
+
+        vkCmdPushConstants (
+            cmd, state->pipeline->pipelineLayout,
+            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            0, sizeof (indices), indices
+        );
+        vkCmdDrawIndexed (
+            cmd, packet.indexCount, 1,
+            packet.firstIndex, packet.vertexOffset, 0
+        );
+    }
+}
+
+uint32_t RenderQueue::size () const
+{
+    return static_cast<uint32_t>(packets.size ());
+}
+
+}
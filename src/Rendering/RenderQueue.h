@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+class JojoPipeline;
+
+namespace Rendering {
+
+enum class Pass : uint8_t {
+  Opaque,
+  Transparent,
+  Count
+};
+
+// Indices are pushed as constants {transIndex, materialIndex} before
+// every draw, matching JojoVulkanMesh::DrawInfo
+struct DrawPacket {
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t transIndex;
+  uint32_t materialIndex;
+};
+
+struct PipelineState {
+  const JojoPipeline *pipeline;
+  VkDescriptorSet descriptorSet;
+};
+
+// Every draw gets a 64 bit key, from the most significant bits:
+// pass (2), pipeline (6), material (16), depth bucket (16) and the
+// packet index (24). Sorting the keys groups opaque draws by state and
+// orders them front to back within each material. Transparent keys
+// swap material and depth, so blending goes back to front across
+// materials and only equal depth buckets group by material.
+class RenderQueue {
+ public:
+  uint32_t addPipeline(const PipelineState &state);
+  void clear();
+  void push(Pass pass, uint32_t pipeline, float depth, const DrawPacket &packet);
+  void sort();
+  void cmdSubmit(VkCommandBuffer cmd, Pass pass) const;
+  uint32_t size() const;
+
+ private:
+  std::vector<PipelineState> pipelines;
+  std::vector<DrawPacket> packets;
+  std::vector<uint64_t> keys;
+  std::vector<uint64_t> scratch;
+};
+
+}
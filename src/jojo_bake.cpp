@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#include "jojo_bake.hpp"
+
+namespace Bake {
+
+static const uint8_t magic[4]  = { 'H', 'K', 'M', 'D' };
+static const size_t  lumpAlign = 16;
+
+static_assert (std::is_trivially_copyable<Object::Vertex>::value, "Vertex is written raw");
+static_assert (std::is_trivially_copyable<Object::Primitive>::value, "Primitive is written raw");
+static_assert (std::is_trivially_copyable<Object::Material>::value, "Material is written raw");
+static_assert (std::is_trivially_copyable<Node>::value, "Node is written raw");
+static_assert (std::is_trivially_copyable<Header>::value, "Header is written raw");
+
+uint64_t hashFile (
+    const std::string  &path
+) {
+    std::ifstream file (path, std::ios_base::in | std::ios_base::binary);
+    if (!file.is_open ())
+        return 0;
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+    char     chunk[4096];
+
+    while (file) {
+        file.read (chunk, sizeof (chunk));
+        const auto count = file.gcount ();
+        for (std::streamsize i = 0; i < count; ++i) {
+            hash ^= (uint8_t)chunk[i];
+            hash *= 0x100000001B3ull;
+        }
+    }
+
+    return hash;
+}
+
+// --------------------------------------------------------------
+// WRITE START
+// --------------------------------------------------------------
+
+static void flattenNode (
+    const Scene::Node              &node,
+    std::vector<Node>              *nodes,
+    std::vector<Object::Primitive> *primitives
+) {
+    Node baked = {};
+    baked.relative       = node.relative;
+    baked.dynamicTrans   = node.dynamicTrans;
+    baked.childCount     = (uint32_t)node.children.size ();
+    baked.primitiveCount = (uint32_t)node.primitives.size ();
+
+    nodes->push_back (baked);
+    primitives->insert (
+        primitives->end (),
+        node.primitives.begin (),
+        node.primitives.end ()
+    );
+
+    for (const auto &child : node.children)
+        flattenNode (child, nodes, primitives);
+}
+
+static void addLump (
+    const Lump            lump,
+    const void           *data,
+    const size_t          length,
+    Header               *header,
+    std::vector<uint8_t> *buffer
+) {
+    // Keep every lump aligned, they are used in place after loading
+    buffer->resize ((buffer->size () + lumpAlign - 1) / lumpAlign * lumpAlign);
+
+    auto &entry  = header->direntries[lump];
+    entry.offset = buffer->size ();
+    entry.length = length;
+
+    const auto bytes = (const uint8_t *)data;
+    buffer->insert (buffer->end (), bytes, bytes + length);
+}
+
+bool writeModel (
+    const std::string  &path,
+    const uint64_t      sourceHash,
+    const Scene::Scene &scene,
+    const Scene::Model &model
+) {
+    Header                         header = {};
+    std::vector<uint8_t>           buffer (sizeof (Header));
+    std::vector<Node>              nodes;
+    std::vector<Object::Primitive> primitives;
+    std::vector<uint8_t>           texels;
+
+    std::copy (magic, magic + 4, header.magic);
+    header.version     = version;
+    header.sourceHash  = sourceHash;
+    header.rootCount   = (uint32_t)model.nodes.size ();
+    header.numDynTrans = model.numDynTrans;
+    header.minExtent   = model.minExtent;
+    header.maxExtent   = model.maxExtent;
+
+    for (const auto &node : model.nodes)
+        flattenNode (node, &nodes, &primitives);
+
+    for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+        const auto &bucket = scene.textures[b];
+
+        header.textureLayers[b] = bucket.layers;
+        texels.insert (texels.end (), bucket.data.begin (), bucket.data.end ());
+    }
+
+    const auto materials = scene.materials.data () + model.materialBase;
+
+    addLump (Nodes, nodes.data (), nodes.size () * sizeof (Node), &header, &buffer);
+    addLump (Primitives, primitives.data (), primitives.size () * sizeof (Object::Primitive), &header, &buffer);
+    addLump (Vertices, model.vertices.data (), model.vertices.size () * sizeof (Object::Vertex), &header, &buffer);
+    addLump (Indices, model.indices.data (), model.indices.size () * sizeof (uint32_t), &header, &buffer);
+    addLump (Materials, materials, model.materialCount * sizeof (Object::Material), &header, &buffer);
+    addLump (Textures, texels.data (), texels.size (), &header, &buffer);
+
+    std::memcpy (buffer.data (), &header, sizeof (Header));
+
+    std::ofstream file (
+        path,
+        std::ios_base::out | std::ios_base::binary | std::ios_base::trunc
+    );
+    if (!file.is_open ())
+        return false;
+
+    file.write ((const char *)buffer.data (), buffer.size ());
+    return file.good ();
+}
+
+// --------------------------------------------------------------
+// WRITE END
+// --------------------------------------------------------------
+
+// --------------------------------------------------------------
+// LOAD START
+// --------------------------------------------------------------
+
+template <typename T>
+static const T *lumpData (
+    const Header         *header,
+    const uint8_t        *data,
+    const Lump            lump,
+    size_t               *count
+) {
+    const auto &entry = header->direntries[lump];
+    *count = entry.length / sizeof (T);
+    return (const T *)(data + entry.offset);
+}
+
+static bool readNode (
+    const Node              **node,
+    const Node               *nodesEnd,
+    const Object::Primitive **primitive,
+    const Object::Primitive  *primitivesEnd,
+    Scene::Node              *sceneNode
+) {
+    if (*node == nodesEnd)
+        return false;
+
+    const auto &baked = **node;
+    *node += 1;
+
+    if ((size_t)(primitivesEnd - *primitive) < baked.primitiveCount)
+        return false;
+
+    sceneNode->relative     = baked.relative;
+    sceneNode->dynamicTrans = baked.dynamicTrans;
+    sceneNode->primitives.assign (*primitive, *primitive + baked.primitiveCount);
+    *primitive += baked.primitiveCount;
+
+    sceneNode->children.resize (baked.childCount);
+    for (auto &child : sceneNode->children) {
+        const auto read = readNode (
+            node, nodesEnd, primitive, primitivesEnd, &child
+        );
+        if (!read)
+            return false;
+    }
+
+    return true;
+}
+
+// Layers of a bucket may come from its free list, so they are looked
+// up instead of offset
+static void rebaseSlot (
+    const std::vector<uint32_t> *layers,
+    const Scene::Scene          *scene,
+    float                       *layer,
+    float                       *bucket
+) {
+    const auto b = (uint32_t)*bucket;
+
+    if (b < Scene::textureBucketCount) {
+        *layer = (float)layers[b][(uint32_t)*layer];
+        return;
+    }
+
+    const auto &slot = (uint32_t)*layer == defaultNormal.layer
+        ? scene->defaultNormal
+        : scene->defaultTexture;
+    *layer  = (float)slot.layer;
+    *bucket = (float)slot.bucket;
+}
+
+bool loadModel (
+    const std::string &path,
+    const uint64_t     sourceHash,
+    Scene::Model      *model,
+    Scene::Scene      *scene
+) {
+    std::ifstream file (
+        path,
+        std::ios_base::in | std::ios_base::binary | std::ios_base::ate
+    );
+    if (!file.is_open ())
+        return false;
+
+    // Load whole file into memory
+    auto size = file.tellg ();
+    file.seekg (0, std::ios::beg);
+    std::vector<uint8_t> buffer ((size_t)size);
+    file.read ((char *)buffer.data (), size);
+    file.close ();
+
+    if (buffer.size () < sizeof (Header))
+        return false;
+
+    const auto header = (const Header *)buffer.data ();
+    if (!std::equal (magic, magic + 4, header->magic) || header->version != version)
+        return false;
+
+    if (sourceHash != 0 && header->sourceHash != sourceHash) {
+        std::cerr << path << " was baked from an older glTF file, "
+                  << "loading the glTF file instead" << std::endl;
+        return false;
+    }
+
+    for (const auto &entry : header->direntries) {
+        if (entry.offset > buffer.size () || entry.length > buffer.size () - entry.offset)
+            return false;
+    }
+
+    size_t numNodes, numPrimitives, numVertices, numIndices, numMaterials, numTexels;
+    const auto data       = buffer.data ();
+    const auto nodes      = lumpData<Node> (header, data, Nodes, &numNodes);
+    const auto primitives = lumpData<Object::Primitive> (header, data, Primitives, &numPrimitives);
+    const auto vertices   = lumpData<Object::Vertex> (header, data, Vertices, &numVertices);
+    const auto indices    = lumpData<uint32_t> (header, data, Indices, &numIndices);
+    const auto materials  = lumpData<Object::Material> (header, data, Materials, &numMaterials);
+    const auto texels     = lumpData<uint8_t> (header, data, Textures, &numTexels);
+
+    {
+        size_t expectedTexels = 0;
+        for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+            const size_t texSize = Scene::minTextureSize << b;
+            expectedTexels += header->textureLayers[b] * texSize * texSize * 4;
+        }
+        if (expectedTexels != numTexels)
+            return false;
+
+        for (size_t i = 0; i < numMaterials; ++i) {
+            const auto &m = materials[i];
+            const float slots[][2] = {
+                { m.texture, m.textureBucket },
+                { m.normal, m.normalBucket }
+            };
+
+            for (const auto &slot : slots) {
+                const auto b = (uint32_t)slot[1];
+                if (b < Scene::textureBucketCount && (uint32_t)slot[0] >= header->textureLayers[b])
+                    return false;
+            }
+        }
+
+    // --------------------------------------------------------------
+    // NODES START
+    // --------------------------------------------------------------
+
+    // Read before anything is appended to the scene, so a broken
+    // file leaves the scene untouched for the glTF fallback
+    {
+        auto node      = nodes;
+        auto primitive = primitives;
+
+        model->nodes.resize (header->rootCount);
+        for (auto &root : model->nodes) {
+            const auto read = readNode (
+                &node, nodes + numNodes,
+                &primitive, primitives + numPrimitives, &root
+            );
+            if (!read) {
+                model->nodes.clear ();
+                return false;
+            }
+        }
+    }
+
+    // --------------------------------------------------------------
+    // NODES END
+    // --------------------------------------------------------------
+
+    model->vertices.assign (vertices, vertices + numVertices);
+    model->indices.assign (indices, indices + numIndices);
+
+    // --------------------------------------------------------------
+    // TEXTURES START
+    // --------------------------------------------------------------
+
+    std::vector<uint32_t> layers[Scene::textureBucketCount];
+
+    {
+        auto texel = texels;
+
+        for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+            const auto texSize   = Scene::minTextureSize << b;
+            const auto layerSize = texSize * texSize * 4;
+
+            for (uint32_t l = 0; l < header->textureLayers[b]; ++l) {
+                Scene::TextureSlot slot;
+                const auto sceneTexture = Scene::allocTexture (
+                    texSize, texSize, scene, &slot
+                );
+
+                std::copy (texel, texel + layerSize, sceneTexture);
+                texel += layerSize;
+
+                layers[b].push_back (slot.layer);
+                model->textures.push_back (slot);
+            }
+        }
+    }
+
+    // --------------------------------------------------------------
+    // TEXTURES END
+    // --------------------------------------------------------------
+
+    const auto materialBase = Scene::allocMaterials ((uint32_t)numMaterials, scene);
+    std::copy (materials, materials + numMaterials, scene->materials.begin () + materialBase);
+    for (size_t i = materialBase; i < scene->materials.size (); ++i) {
+        auto &m = scene->materials[i];
+        rebaseSlot (layers, scene, &m.texture, &m.textureBucket);
+        rebaseSlot (layers, scene, &m.normal, &m.normalBucket);
+    }
+
+    model->numDynTrans   = header->numDynTrans;
+    model->materialBase  = materialBase;
+    model->materialCount = (uint32_t)numMaterials;
+    model->minExtent     = header->minExtent;
+    model->maxExtent     = header->maxExtent;
+
+    return true;
+}
+
+// --------------------------------------------------------------
+// LOAD END
+// --------------------------------------------------------------
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "jojo_scene.hpp"
+
+namespace Bake {
+
+// Baked models (models/<name>.hkm) hold the final engine layout of a
+// single model: flattened nodes, primitives with their LODs, vertices,
+// indices, materials and decoded RGBA8 textures. All lumps are written
+// raw, so the version has to change with Vertex, Primitive, Material
+// or any of the structs below. The source hash ties a bake to the
+// exact glTF file it was made from.
+const uint32_t version = 4;
+
+enum Lump : uint8_t {
+    Nodes,
+    Primitives,
+    Vertices,
+    Indices,
+    Materials,
+    Textures,
+    LumpCount
+};
+
+struct DirEntry {
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct Header {
+    uint8_t    magic[4];
+    uint32_t   version;
+    DirEntry   direntries[LumpCount];
+    uint64_t   sourceHash;
+
+    uint32_t   rootCount;
+    uint32_t   numDynTrans;
+    glm::vec3  minExtent;
+    glm::vec3  maxExtent;
+    uint32_t   textureLayers[Scene::textureBucketCount];
+};
+
+// Scene::Node in pre-order, the children of a node follow it directly
+struct Node {
+    glm::mat4  relative;
+    int64_t    dynamicTrans;
+    uint32_t   childCount;
+    uint32_t   primitiveCount;
+};
+
+// Texture slots of baked materials are relative to the model, this
+// bucket marks the default texture (layer 0) and normal map (layer 1)
+const Scene::TextureSlot defaultTexture = { Scene::textureBucketCount, 0 };
+const Scene::TextureSlot defaultNormal  = { Scene::textureBucketCount, 1 };
+
+// 64 bit FNV-1a over the whole file, 0 if it cannot be read
+uint64_t hashFile (
+    const std::string         &path
+);
+
+// Writes a model of a scene that holds nothing else, loaded with the
+// default slots above
+bool writeModel (
+    const std::string         &path,
+    uint64_t                   sourceHash,
+    const Scene::Scene        &scene,
+    const Scene::Model        &model
+);
+
+// Appends a baked model to the scene, returns false if the file is
+// missing, was baked for another version or from another source file.
+// A source hash of 0 (no glTF file around) accepts any bake.
+bool loadModel (
+    const std::string         &path,
+    uint64_t                   sourceHash,
+    Scene::Model              *model,
+    Scene::Scene              *scene
+);
+
+}
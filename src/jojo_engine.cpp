@@ -88,8 +88,10 @@ void JojoEngine::startVulkan() {
 
 void JojoEngine::initializeDescriptorPool(uint32_t uniformCount,
                                          uint32_t dynamicUniformCount,
-                                         uint32_t samplerCount) {
-    VkResult result = createDescriptorPool(device, &descriptorPool, uniformCount, dynamicUniformCount, samplerCount);
+                                         uint32_t samplerCount,
+                                         uint32_t storageCount) {
+    VkResult result = createDescriptorPool(device, &descriptorPool, uniformCount, dynamicUniformCount, samplerCount,
+                                           storageCount);
     ASSERT_VULKAN (result);
 
     descriptors = new Rendering::DescriptorSets (device);
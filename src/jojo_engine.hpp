@@ -43,6 +43,7 @@ public:
 
     void shutdownVulkan();
 
-    void initializeDescriptorPool(uint32_t uniformCount, uint32_t dynamicUniformCount, uint32_t samplerCount);
+    void initializeDescriptorPool(uint32_t uniformCount, uint32_t dynamicUniformCount, uint32_t samplerCount,
+                                  uint32_t storageCount);
 };
 
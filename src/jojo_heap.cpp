@@ -0,0 +1,80 @@
+#include <algorithm>
+
+#include "jojo_heap.hpp"
+
+namespace Heap {
+
+void init (
+    const uint32_t  capacity,
+    FreeList       *list
+) {
+    list->capacity = capacity;
+    list->used     = 0;
+    list->free.clear ();
+    list->free.push_back ({ 0, capacity });
+}
+
+bool alloc (
+    const uint32_t  count,
+    FreeList       *list,
+    Range          *range
+) {
+    auto &free = list->free;
+
+    for (size_t i = 0; i < free.size (); ++i) {
+        auto &block = free[i];
+        if (block.count < count)
+            continue;
+
+        range->offset = block.offset;
+        range->count  = count;
+
+        block.offset += count;
+        block.count  -= count;
+        if (block.count == 0)
+            free.erase (free.begin () + i);
+
+        list->used += count;
+        return true;
+    }
+
+    return false;
+}
+
+void release (
+    const Range &range,
+    FreeList    *list
+) {
+    auto &free = list->free;
+
+    if (range.count == 0)
+        return;
+
+    const auto next = std::lower_bound (
+        free.begin (), free.end (), range,
+        [] (const Range &l, const Range &r) {
+            return l.offset < r.offset;
+        }
+    );
+    auto it = free.insert (next, range);
+
+    // Merge with the following range
+    const auto after = it + 1;
+    if (after != free.end () && it->offset + it->count == after->offset) {
+        it->count += after->count;
+        free.erase (after);
+    }
+
+    // Merge with the preceding range
+    if (it != free.begin ()) {
+        const auto before = it - 1;
+        if (before->offset + before->count == it->offset) {
+            before->count += it->count;
+            free.erase (it);
+        }
+    }
+
+    list->used -= range.count;
+}
+
+}
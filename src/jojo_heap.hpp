@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace Heap {
+
+struct Range {
+    uint32_t offset;
+    uint32_t count;
+};
+
+// First fit free list over [0, capacity) elements of a buffer. Free
+// ranges are kept sorted by offset and merged with their neighbours
+// when released, so evicting models does not fragment the heap forever.
+struct FreeList {
+    uint32_t           capacity;
+    uint32_t           used;
+    std::vector<Range> free;
+};
+
+void init (
+    uint32_t  capacity,
+    FreeList *list
+);
+
+bool alloc (
+    uint32_t  count,
+    FreeList *list,
+    Range    *range
+);
+
+void release (
+    const Range &range,
+    FreeList    *list
+);
+
+}
@@ -336,52 +336,6 @@ void updateDescriptors (
     descriptors->update (Rendering::Set::Transparent, 2, lightmap);
 }
 
-void loadRigidBodies (
-    JojoLevel               *level
-) {
-    const auto bsp = level->bsp.get ();
-
-    BSP::buildColliders (
-        bsp->header, bsp->leafs, bsp->leafBrushes, bsp->brushes,
-        bsp->brushSides, bsp->planes, bsp->textureData,
-        &level->collisionShapes, &level->motionStates,
-        &level->rigidBodies
-    );
-}
-
-void addRigidBodies (
-    JojoLevel               *level,
-    btDiscreteDynamicsWorld *world
-) {
-    const auto numBodies = level->rigidBodies.size ();
-    auto &bodies = level->rigidBodies;
-    for (int i = 0; i < numBodies; i++)
-        world->addRigidBody (bodies[i]);
-}
-
-void removeRigidBodies (
-    JojoLevel               *level,
-    btDiscreteDynamicsWorld *world
-) {
-    const btVector3 zeroVector (0, 0, 0);
-    const auto      numBodies = level->rigidBodies.size ();
-    auto           &bodies = level->rigidBodies;
-
-    btTransform startTransform;
-    startTransform.setIdentity ();
-    startTransform.setOrigin (btVector3 (0, 0, 0));
-
-    for (int i = 0; i < numBodies; i++) {
-        world->removeRigidBody (bodies[i]);
-
-        bodies[i]->clearForces ();
-        bodies[i]->setLinearVelocity (zeroVector);
-        bodies[i]->setAngularVelocity (zeroVector);
-        bodies[i]->setWorldTransform (startTransform);
-    }
-
-}
-
 void cmdDraw (
     const VkCommandBuffer    drawCmd,
     const JojoLevel         *level
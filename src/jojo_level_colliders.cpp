@@ -0,0 +1,54 @@
+// Level collision bodies, kept apart from jojo_level.cpp so the
+// simulation sources do not depend on the Vulkan level code
+#include "jojo_level.hpp"
+#include "jojo_physics.hpp"
+
+namespace Level {
+
+void loadRigidBodies (
+    JojoLevel               *level
+) {
+    const auto bsp = level->bsp.get ();
+
+    BSP::buildColliders (
+        bsp->header, bsp->leafs, bsp->leafBrushes, bsp->brushes,
+        bsp->brushSides, bsp->planes, bsp->textureData,
+        &level->collisionShapes, &level->motionStates,
+        &level->rigidBodies
+    );
+}
+
+void addRigidBodies (
+    JojoLevel               *level,
+    btDiscreteDynamicsWorld *world
+) {
+    const auto numBodies = level->rigidBodies.size ();
+    auto &bodies = level->rigidBodies;
+    for (int i = 0; i < numBodies; i++)
+        world->addRigidBody (bodies[i], Physics::LevelGroup, Physics::levelMask);
+}
+
+void removeRigidBodies (
+    JojoLevel               *level,
+    btDiscreteDynamicsWorld *world
+) {
+    const btVector3 zeroVector (0, 0, 0);
+    const auto      numBodies = level->rigidBodies.size ();
+    auto           &bodies = level->rigidBodies;
+
+    btTransform startTransform;
+    startTransform.setIdentity ();
+    startTransform.setOrigin (btVector3 (0, 0, 0));
+
+    for (int i = 0; i < numBodies; i++) {
+        world->removeRigidBody (bodies[i]);
+
+        bodies[i]->clearForces ();
+        bodies[i]->setLinearVelocity (zeroVector);
+        bodies[i]->setAngularVelocity (zeroVector);
+        bodies[i]->setWorldTransform (startTransform);
+    }
+
+}
+
+}
@@ -2,16 +2,158 @@
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 #define STB_IMAGE_IMPLEMENTATION
 #define _SILENCE_CXX17_OLD_ALLOCATOR_MEMBERS_DEPRECATION_WARNING
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <glm/gtc/packing.hpp>
 #include <tiny_gltf.h>
 #include <LinearMath/btVector3.h>
 #include <LinearMath/btAlignedObjectArray.h>
+#include <LinearMath/btConvexHull.h>
 
+#include "jojo_bake.hpp"
 #include "jojo_scene.hpp"
+#include "jojo_simplify.hpp"
 
 namespace Object {
 
 using namespace glm;
 
+// Upper bound for the vertices of generated collision hulls
+static const uint32_t maxHullVertices = 32;
+
+// Smaller primitives keep a single detail level. Every further level
+// aims for half the triangles of the previous one, with the collapse
+// error bounded relative to the size of the primitive.
+static const uint32_t minLodTriangles = 64;
+static const float    lodMaxError     = 0.05f;
+
+static void generateLods (
+    const FloatVertex     *vertices,
+    const uint32_t         vertexCount,
+    std::vector<uint32_t> *indices,
+    Primitive             *primitive
+) {
+    vec3 minExtent (std::numeric_limits<float>::max ());
+    vec3 maxExtent (-std::numeric_limits<float>::max ());
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        minExtent = min (vertices[i].pos, minExtent);
+        maxExtent = max (vertices[i].pos, maxExtent);
+    }
+
+    const auto maxError = lodMaxError * length (maxExtent - minExtent);
+
+    std::vector<uint32_t> source;
+    std::vector<uint32_t> lod;
+
+    for (uint32_t l = 1; l < maxLods; ++l) {
+        const auto &prev = primitive->lods[l - 1];
+        if (prev.indexCount < minLodTriangles * 3)
+            break;
+
+        source.assign (
+            indices->begin () + prev.indexOffset,
+            indices->begin () + prev.indexOffset + prev.indexCount
+        );
+        lod.resize (prev.indexCount);
+
+        const auto count = Simplify::simplify (
+            vertices, vertexCount,
+            source.data (), prev.indexCount,
+            prev.indexCount / 6 * 3,
+            maxError * maxError, lod.data ()
+        );
+
+        // Not worth another level when most triangles are left
+        if (count == 0 || count > prev.indexCount * 3 / 4)
+            break;
+
+        auto &level = primitive->lods[l];
+        level.indexCount  = count;
+        level.indexOffset = (uint32_t)indices->size ();
+        indices->insert (indices->end (), lod.begin (), lod.begin () + count);
+        primitive->lodCount += 1;
+    }
+}
+
+// Reads the first components of every element of an accessor as
+// floats. Views may be strided and components may be integers, with or
+// without normalization, as allowed by KHR_mesh_quantization.
+static bool readAccessor (
+    const tinygltf::Accessor   &accessor,
+    const tinygltf::BufferView *views,
+    const tinygltf::Buffer     *buffers,
+    const uint32_t              components,
+    std::vector<float>         *out
+) {
+    if (accessor.bufferView < 0)
+        return false;
+
+    const auto &view   = views[accessor.bufferView];
+    const auto  stride = accessor.ByteStride (view);
+    const auto  size   = tinygltf::GetComponentSizeInBytes (accessor.componentType);
+    const auto  count  = tinygltf::GetTypeSizeInBytes (accessor.type);
+    if (stride <= 0 || size <= 0 || count < (int32_t)components)
+        return false;
+
+    const auto &buffer = buffers[view.buffer].data;
+    const auto  offset = view.byteOffset + accessor.byteOffset;
+    if (accessor.count > 0
+        && offset + (accessor.count - 1) * stride + components * size > buffer.size ())
+        return false;
+
+    const auto normalized = accessor.normalized;
+    const auto data       = buffer.data () + offset;
+
+    out->resize (accessor.count * components);
+    for (size_t i = 0; i < accessor.count; ++i) {
+        for (uint32_t c = 0; c < components; ++c) {
+            const auto src = data + i * stride + c * size;
+            float      value;
+
+            switch (accessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_FLOAT:
+                std::memcpy (&value, src, sizeof (float));
+                break;
+            case TINYGLTF_COMPONENT_TYPE_BYTE:
+            {
+                int8_t v;
+                std::memcpy (&v, src, sizeof (v));
+                value = normalized ? std::max (v / 127.0f, -1.0f) : v;
+            }
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            {
+                uint8_t v;
+                std::memcpy (&v, src, sizeof (v));
+                value = normalized ? v / 255.0f : v;
+            }
+                break;
+            case TINYGLTF_COMPONENT_TYPE_SHORT:
+            {
+                int16_t v;
+                std::memcpy (&v, src, sizeof (v));
+                value = normalized ? std::max (v / 32767.0f, -1.0f) : v;
+            }
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            {
+                uint16_t v;
+                std::memcpy (&v, src, sizeof (v));
+                value = normalized ? v / 65535.0f : v;
+            }
+                break;
+            default:
+                return false;
+            }
+
+            (*out)[i * components + c] = value;
+        }
+    }
+
+    return true;
+}
+
 static void loadMesh (
     const tinygltf::Mesh         &mesh,
     const tinygltf::Accessor     *accessors,
@@ -19,11 +161,9 @@ static void loadMesh (
     const tinygltf::Buffer       *buffers,
     const uint32_t                dynamicMVP,
     const uint32_t                materialOffset,
-    std::vector<Vertex>          *vertices,
+    std::vector<FloatVertex>     *vertices,
     std::vector<uint32_t>        *indices,
-    std::vector<Primitive>       *primitives,
-    vec3                         *minExtent,
-    vec3                         *maxExtent
+    std::vector<Primitive>       *primitives
 ) {
     primitives->reserve (primitives->size () + mesh.primitives.size ());
 
@@ -37,11 +177,10 @@ static void loadMesh (
         // LOAD VERTICES START
         // --------------------------------------------------------------
         {
-            const uint32_t currentNum = (uint32_t)vertices->size ();
-            const vec3    *pos        = nullptr;
-            const vec3    *nml        = nullptr;
-            const vec2    *tex        = nullptr;
-            uint32_t       num        = 0;
+            const uint32_t     currentNum = (uint32_t)vertices->size ();
+            std::vector<float> pos;
+            std::vector<float> nml;
+            std::vector<float> tex;
 
             {
                 const auto &posIt = p.attributes.find ("POSITION");
@@ -51,45 +190,27 @@ static void loadMesh (
                 if (posIt == end || nmlIt == end || texIt == end)
                     continue;
 
-                const auto &posAccessor = accessors[posIt->second];
-                const auto &posView = views[posAccessor.bufferView];
-                const auto &nmlAccessor = accessors[nmlIt->second];
-                const auto &nmlView = views[nmlAccessor.bufferView];
-                const auto &texAccessor = accessors[texIt->second];
-                const auto &texView = views[texAccessor.bufferView];
-
-                pos = (const vec3 *)(
-                    buffers[posView.buffer].data.data ()
-                    + posAccessor.byteOffset
-                    + posView.byteOffset
-                    );
-                nml = (const vec3 *)(
-                    buffers[nmlView.buffer].data.data ()
-                    + nmlAccessor.byteOffset
-                    + nmlView.byteOffset
-                    );
-                tex = (const vec2 *)(
-                    buffers[texView.buffer].data.data ()
-                    + texAccessor.byteOffset
-                    + texView.byteOffset
-                    );
-
-                num = (uint32_t)posAccessor.count;
+                const bool read =
+                    readAccessor (accessors[posIt->second], views, buffers, 3, &pos)
+                    && readAccessor (accessors[nmlIt->second], views, buffers, 3, &nml)
+                    && readAccessor (accessors[texIt->second], views, buffers, 2, &tex);
+                CHECK (read);
             }
 
+            const auto num = (uint32_t)pos.size () / 3;
+            const bool complete = nml.size () / 3 >= num && tex.size () / 2 >= num;
+            CHECK (complete);
+
             vertices->resize (currentNum + num);
             for (uint32_t i = 0; i < num; ++i) {
                 auto &vert = vertices->data()[i + currentNum];
 
-                vert.pos = pos[i];
-                vert.nml = nml[i];
-                vert.tex = tex[i];
+                vert.pos = make_vec3 (&pos[i * 3]);
+                vert.nml = make_vec3 (&nml[i * 3]);
+                vert.tex = make_vec2 (&tex[i * 2]);
 
                 vert.pos.y = -vert.pos.y;
                 vert.nml.y = -vert.nml.y;
-
-                *minExtent = min (vert.pos, *minExtent);
-                *maxExtent = max (vert.pos, *maxExtent);
             }
 
             primitive.vertexOffset = currentNum;
@@ -153,20 +274,45 @@ static void loadMesh (
                 CHECK (false);
             }
 
-            primitive.indexCount  = num;
-            primitive.indexOffset = currentNum;
+            primitive.lods[0].indexCount  = num;
+            primitive.lods[0].indexOffset = currentNum;
+            primitive.lodCount            = 1;
         }
 
         // --------------------------------------------------------------
         // LOAD INDICES END
         // --------------------------------------------------------------
-        
+
         primitive.dynamicMaterial = materialOffset + p.material;
         primitive.dynamicMVP      = dynamicMVP;
         primitives->emplace_back (std::move (primitive));
     }
 }
 
+static mat4 nodeMatrix (
+    const tinygltf::Node &node
+) {
+    vec3 translation;
+    vec3 scale (1.0f);
+    mat4 rotation;
+
+    if (node.matrix.size () == 16)
+        return make_mat4 (node.matrix.data ());
+
+    if (node.translation.size () == 3)
+        translation = make_vec3 (node.translation.data ());
+    if (node.scale.size () == 3)
+        scale = make_vec3 (node.scale.data ());
+    if (node.rotation.size () == 4) {
+        quat q = make_quat (node.rotation.data ());
+        rotation = mat4 (q);
+    }
+
+    return glm::translate (translation)
+        * rotation
+        * glm::scale (scale);
+}
+
 static void loadNode (
     const tinygltf::Node         *nodes,
     const tinygltf::Mesh         *meshes,
@@ -176,49 +322,20 @@ static void loadNode (
     const uint32_t                currentDynamicMVP,
     const uint32_t                materialOffset,
     const int32_t                 currentNode,
-    std::vector<Vertex>          *vertices,
+    std::vector<FloatVertex>     *vertices,
     std::vector<uint32_t>        *indices,
     uint32_t                     *nextDynamicMVP,
-    vec3                         *minExtent,
-    vec3                         *maxExtent,
     Scene::Node                  *sceneNode
 ) {
     const auto &node = nodes[currentNode];
 
-    // --------------------------------------------------------------
-    // INITIALIZE MATRIX START
-    // --------------------------------------------------------------
-
-    vec3 translation;
-    vec3 scale (1.0f);
-    mat4 rotation;
-    mat4 local;
-
-    if (node.translation.size () == 3)
-        translation = make_vec3 (node.translation.data ());
-    if (node.scale.size () == 3)
-        scale = make_vec3 (node.scale.data ());
-    if (node.rotation.size () == 4) {
-        quat q = make_quat (node.rotation.data ());
-        rotation = mat4 (q);
-    }
-    if (node.matrix.size () == 16) {
-        sceneNode->relative = make_mat4 (node.matrix.data ());
-    } else {
-        sceneNode->relative = glm::translate (translation)
-            * rotation
-            * glm::scale (scale);
-    }
-
-    // --------------------------------------------------------------
-    // INITIALIZE MATRIX END
-    // --------------------------------------------------------------
+    sceneNode->relative = nodeMatrix (node);
 
     if (node.mesh > -1) {
         loadMesh (
             meshes[node.mesh], accessors, views, buffers,
             currentDynamicMVP, materialOffset, vertices, indices,
-            &sceneNode->primitives, minExtent, maxExtent
+            &sceneNode->primitives
         );
   
         *nextDynamicMVP += 1;
@@ -240,8 +357,7 @@ static void loadNode (
                 nodes, meshes, accessors, views, buffers,
                 *nextDynamicMVP, materialOffset,
                 node.children[n], vertices, indices,
-                nextDynamicMVP, minExtent,
-                maxExtent, &sceneNode->children[n]
+                nextDynamicMVP, &sceneNode->children[n]
             );
         }
     }
@@ -251,20 +367,178 @@ static void loadNode (
     // --------------------------------------------------------------
 }
 
-static void loadTemplateFromGLB (
+struct FlatPrimitive {
+    const Primitive *primitive;
+    mat4             matrix;
+    uint32_t         vertexCount;
+};
+
+static void collectPrimitives (
+    const Scene::Node          &node,
+    const mat4                 &parentMatrix,
+    std::vector<FlatPrimitive> *flat
+) {
+    // Same composition as the collision hulls
+    const auto matrix = node.relative * parentMatrix;
+
+    for (const auto &primitive : node.primitives)
+        flat->push_back ({ &primitive, matrix, 0 });
+
+    for (const auto &child : node.children)
+        collectPrimitives (child, matrix, flat);
+}
+
+// Node transforms never change after loading, so they are baked into
+// the vertices and primitives sharing a material are merged. Models
+// end up with a single node, a single transform slot and one draw per
+// material. Detail levels are generated for the merged primitives.
+static void flattenModel (
+    std::vector<FloatVertex> *vertices,
+    Scene::Model             *model
+) {
+    std::vector<FlatPrimitive> flat;
+    for (const auto &node : model->nodes)
+        collectPrimitives (node, mat4 (1.0f), &flat);
+
+    // Every primitive owns the vertices up to the next one
+    {
+        std::vector<uint32_t> offsets;
+        offsets.reserve (flat.size () + 1);
+        for (const auto &f : flat)
+            offsets.push_back (f.primitive->vertexOffset);
+        offsets.push_back ((uint32_t)vertices->size ());
+        std::sort (offsets.begin (), offsets.end ());
+
+        for (auto &f : flat) {
+            const auto next = std::upper_bound (
+                offsets.begin (), offsets.end (),
+                f.primitive->vertexOffset
+            );
+            f.vertexCount = next == offsets.end ()
+                ? 0 : *next - f.primitive->vertexOffset;
+        }
+    }
+
+    std::stable_sort (flat.begin (), flat.end (), [] (const FlatPrimitive &l, const FlatPrimitive &r) {
+        return l.primitive->dynamicMaterial < r.primitive->dynamicMaterial;
+    });
+
+    std::vector<FloatVertex> flatVertices;
+    std::vector<uint32_t>    indices;
+    std::vector<Primitive>   primitives;
+
+    model->minExtent = vec3 (std::numeric_limits<float>::max ());
+    model->maxExtent = vec3 (-std::numeric_limits<float>::max ());
+
+    for (size_t i = 0; i < flat.size ();) {
+        const auto material = flat[i].primitive->dynamicMaterial;
+        Primitive  merged   = {};
+
+        merged.dynamicMaterial     = material;
+        merged.vertexOffset        = (uint32_t)flatVertices.size ();
+        merged.lods[0].indexOffset = (uint32_t)indices.size ();
+        merged.lodCount            = 1;
+
+        for (; i < flat.size () && flat[i].primitive->dynamicMaterial == material; ++i) {
+            const auto &f         = flat[i];
+            const auto &source    = f.primitive->lods[0];
+            const auto  base      = (uint32_t)flatVertices.size () - merged.vertexOffset;
+            const auto  nmlMatrix = inverseTranspose (mat3 (f.matrix));
+
+            for (uint32_t v = 0; v < f.vertexCount; ++v) {
+                auto vert = (*vertices)[f.primitive->vertexOffset + v];
+
+                vert.pos = vec3 (f.matrix * vec4 (vert.pos, 1.0f));
+                vert.nml = normalize (nmlMatrix * vert.nml);
+
+                model->minExtent = min (vert.pos, model->minExtent);
+                model->maxExtent = max (vert.pos, model->maxExtent);
+                flatVertices.push_back (vert);
+            }
+
+            const auto first = (uint32_t)indices.size ();
+            for (uint32_t k = 0; k < source.indexCount; ++k)
+                indices.push_back (base + model->indices[source.indexOffset + k]);
+
+            // Mirroring transforms flip the winding
+            if (determinant (mat3 (f.matrix)) < 0.0f) {
+                for (auto t = first; t + 2 < (uint32_t)indices.size (); t += 3)
+                    std::swap (indices[t + 1], indices[t + 2]);
+            }
+        }
+
+        merged.lods[0].indexCount = (uint32_t)indices.size () - merged.lods[0].indexOffset;
+        generateLods (
+            flatVertices.data () + merged.vertexOffset,
+            (uint32_t)flatVertices.size () - merged.vertexOffset,
+            &indices, &merged
+        );
+
+        primitives.push_back (merged);
+    }
+
+    *vertices          = std::move (flatVertices);
+    model->indices     = std::move (indices);
+    model->numDynTrans = primitives.empty () ? 0 : 1;
+    model->nodes.clear ();
+
+    if (!primitives.empty ()) {
+        Scene::Node root;
+        root.relative     = mat4 (1.0f);
+        root.dynamicTrans = 0;
+        root.primitives   = std::move (primitives);
+        model->nodes.push_back (std::move (root));
+    }
+}
+
+mat4 dequantization (
+    const vec3 &minExtent,
+    const vec3 &maxExtent
+) {
+    const auto center = (minExtent + maxExtent) * 0.5f;
+    const auto half   = max ((maxExtent - minExtent) * 0.5f, vec3 (1e-6f));
+
+    return glm::translate (center) * glm::scale (half);
+}
+
+// Positions are stored relative to the model bounds, the template's
+// transform slot maps them back with dequantization
+static void quantizeVertices (
+    const std::vector<FloatVertex> &vertices,
+    Scene::Model                   *model
+) {
+    const auto quantize = inverse (dequantization (
+        model->minExtent, model->maxExtent
+    ));
+
+    model->vertices.resize (vertices.size ());
+    for (size_t i = 0; i < vertices.size (); ++i) {
+        const auto &src = vertices[i];
+        auto       &dst = model->vertices[i];
+        const auto  pos = vec3 (quantize * vec4 (src.pos, 1.0f));
+
+        for (uint32_t c = 0; c < 3; ++c) {
+            dst.pos[c] = (int16_t)packSnorm1x16 (pos[c]);
+            dst.nml[c] = (int8_t)packSnorm1x8 (src.nml[c]);
+        }
+        dst.pos[3] = 0;
+        dst.nml[3] = 0;
+
+        dst.tex[0] = packHalf1x16 (src.tex.x);
+        dst.tex[1] = packHalf1x16 (src.tex.y);
+    }
+}
+
+void loadModelFromGLB (
     const std::string            &modelName,
-    const uint32_t                currentDynamicMVP,
-    std::vector<Vertex>          *vertices,
-    std::vector<uint32_t>        *indices,
-    uint32_t                     *nextDynamicMVP,
-    Scene::Template              *templ,
-    Scene::Scene        *scene
+    Scene::Model                 *sceneModel,
+    Scene::Scene                 *scene
 ) {
-    const auto dynMatBase = (uint32_t)scene->materials.size ();
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
+    std::vector<FloatVertex> vertices;
 
-    templ->nextInstance = 0;
+    sceneModel->numDynTrans = 0;
 
     // --------------------------------------------------------------
     // LOAD BINARY START
@@ -286,23 +560,24 @@ static void loadTemplateFromGLB (
     // PARSE SCENE GRAPH START
     // --------------------------------------------------------------
 
+    // Transform slots and materials are stored relative to the model,
+    // every template using it rebases them in Scene::loadTemplate
     {
         const auto  nodes     = model.nodes.data ();
         const auto  meshes    = model.meshes.data ();
         const auto  accessors = model.accessors.data ();
         const auto  views     = model.bufferViews.data ();
         const auto  buffers   = model.buffers.data ();
-        const auto &scene     = model.scenes[model.defaultScene];
-        const auto  nodeCount = scene.nodes.size ();
+        const auto &root      = model.scenes[model.defaultScene];
+        const auto  nodeCount = root.nodes.size ();
 
-        templ->nodes.resize (nodeCount);
+        sceneModel->nodes.resize (nodeCount);
         for (auto n = 0; n < nodeCount; ++n) {
             loadNode (
                 nodes, meshes, accessors, views, buffers,
-                currentDynamicMVP, dynMatBase,
-                scene.nodes[n], vertices, indices,
-                nextDynamicMVP, &templ->minExtent,
-                &templ->maxExtent, &templ->nodes[n]
+                sceneModel->numDynTrans, 0,
+                root.nodes[n], &vertices, &sceneModel->indices,
+                &sceneModel->numDynTrans, &sceneModel->nodes[n]
             );
         }
     }
@@ -311,26 +586,29 @@ static void loadTemplateFromGLB (
     // PARSE SCENE GRAPH END
     // --------------------------------------------------------------
 
+    flattenModel (&vertices, sceneModel);
+    quantizeVertices (vertices, sceneModel);
+
     // --------------------------------------------------------------
     // PARSE TEXTURES START
     // --------------------------------------------------------------
 
-    const auto textureOffset = scene->textureCount;
+    std::vector<Scene::TextureSlot> textureSlots (model.images.size ());
 
     {
         const auto &images   = model.images;
         const auto numImages = images.size ();
-        auto &sceneTextures  = scene->textures;
-        scene->textureCount += numImages;
 
         for (uint32_t i = 0; i < numImages; i++) {
             const auto &texture      = images[i];
-            const auto width         = texture.width;
-            const auto height        = texture.height;
-            auto       &sceneTexture = sceneTextures[textureOffset + i];
+            const auto  width        = (uint32_t)texture.width;
+            const auto  height       = (uint32_t)texture.height;
+            const auto  sceneTexture = Scene::allocTexture (
+                width, height, scene, &textureSlots[i]
+            );
 
-            // No other texture sizes allowed
-            if (width != 512 ||height != 512) {
+            // Texture size has no matching bucket
+            if (sceneTexture == nullptr) {
                 CHECK (false);
             }
 
@@ -345,12 +623,14 @@ static void loadTemplateFromGLB (
                 std::copy (
                     texture.image.begin (),
                     texture.image.end (),
-                    sceneTexture.begin()
+                    sceneTexture
                 );
             }
         }
     }
 
+    sceneModel->textures = textureSlots;
+
     // --------------------------------------------------------------
     // PARSE TEXTURES END
     // --------------------------------------------------------------
@@ -363,8 +643,11 @@ static void loadTemplateFromGLB (
         const auto &materials    = model.materials;
         const auto &textures     = model.textures;
         const auto numMaterials  = (uint32_t)materials.size ();
+        const auto dynMatBase    = Scene::allocMaterials (numMaterials, scene);
         auto &sceneMaterials     = scene->materials;
-        sceneMaterials.resize (dynMatBase + numMaterials);
+
+        sceneModel->materialBase  = dynMatBase;
+        sceneModel->materialCount = numMaterials;
       
         for (uint32_t i = 0; i < numMaterials; ++i) {
             const auto &m  = materials[i];
@@ -376,42 +659,35 @@ static void loadTemplateFromGLB (
             sm.diffuse  = 0.6f;
             sm.specular = 0.2f;
             sm.alpha    = 2.0f;
-            sm.texture  = 0.0f;
-            sm.normal   = 1.0f;
+            sm.texture       = (float)scene->defaultTexture.layer;
+            sm.textureBucket = (float)scene->defaultTexture.bucket;
+            sm.normal        = (float)scene->defaultNormal.layer;
+            sm.normalBucket  = (float)scene->defaultNormal.bucket;
 
             const auto baseColorTexture = v.find ("baseColorTexture");
             const auto roughness        = v.find ("roughnessFactor");
             const auto metallic         = v.find ("metallicFactor");
 
             if (baseColorTexture != v.end ()) {
-                sm.texture = textureOffset + textures[
+                const auto &slot = textureSlots[textures[
                     baseColorTexture->second.TextureIndex ()
-                ].source;
+                ].source];
+
+                sm.texture       = (float)slot.layer;
+                sm.textureBucket = (float)slot.bucket;
             }
 
             const auto normalTexture    = av.find ("normalTexture");
 
             if (normalTexture != av.end ()) {
-                sm.normal = textureOffset + textures[
+                const auto &slot = textureSlots[textures[
                     normalTexture->second.TextureIndex ()
-                ].source;
-            }
+                ].source];
 
-            if (scene->templates.data () == templ) {
-                sm.diffuse  = 0.2;
-                sm.specular = 0.3;
-            } else if (scene->templates.data() + 3 == templ) {
-                sm.ambient  = 1.5f;
-                sm.diffuse  = 0.0;
-                sm.specular = 0.0;
-            } else {
-                sm.ambient  = 0.08;
-                sm.alpha    = 40;
-                sm.diffuse  = 0.6;
-                sm.specular = 0.3;
+                sm.normal       = (float)slot.layer;
+                sm.normalBucket = (float)slot.bucket;
             }
 
-
            /* if (roughness != v.end ())
                 sm.alpha = roughness->second.Factor () * 42.f;
             if (metallic != v.end ())
@@ -424,6 +700,32 @@ static void loadTemplateFromGLB (
     // --------------------------------------------------------------
 }
 
+static void applyMaterialOverride (
+    const MaterialOverride  materialOverride,
+    Material               *material
+) {
+    switch (materialOverride) {
+    case PlayerMaterial:
+        material->diffuse  = 0.2f;
+        material->specular = 0.3f;
+        break;
+    case GoalMaterial:
+        material->ambient  = 1.5f;
+        material->diffuse  = 0.0f;
+        material->specular = 0.0f;
+        break;
+    case PropMaterial:
+        material->ambient  = 0.08f;
+        material->alpha    = 40.0f;
+        material->diffuse  = 0.6f;
+        material->specular = 0.3f;
+        break;
+    case DefaultMaterial:
+    default:
+        break;
+    }
+}
+
 static void loadConvexNode (
     const tinygltf::Node            *nodes,
     const tinygltf::Mesh            *meshes,
@@ -431,10 +733,15 @@ static void loadConvexNode (
     const tinygltf::BufferView      *views,
     const tinygltf::Buffer          *buffers,
     const int32_t                    currentNode,
+    const mat4                      &parentMatrix,
     btAlignedObjectArray<btVector3> &vertices
 ) {
     const auto &node = nodes[currentNode];
 
+    // Same composition as Scene::updateMatrices, so the hull matches
+    // what is drawn
+    const auto matrix = nodeMatrix (node) * parentMatrix;
+
     if (node.mesh > -1) {
         const auto &mesh = meshes[node.mesh];
 
@@ -446,9 +753,8 @@ static void loadConvexNode (
             // LOAD VERTICES START
             // --------------------------------------------------------------
             {
-                const uint32_t currentNum = (uint32_t)vertices.size();
-                const vec3    *pos = nullptr;
-                uint32_t       num = 0;
+                const uint32_t     currentNum = (uint32_t)vertices.size();
+                std::vector<float> pos;
 
                 {
                     const auto &posIt = p.attributes.find ("POSITION");
@@ -456,26 +762,24 @@ static void loadConvexNode (
                     if (posIt == end)
                         continue;
 
-                    const auto &posAccessor = accessors[posIt->second];
-                    const auto &posView = views[posAccessor.bufferView];
-
-                    pos = (const vec3 *)(
-                        buffers[posView.buffer].data.data ()
-                        + posAccessor.byteOffset
-                        + posView.byteOffset
-                        );
-
-                    num = (uint32_t)posAccessor.count;
+                    const bool read = readAccessor (
+                        accessors[posIt->second], views, buffers, 3, &pos
+                    );
+                    CHECK (read);
                 }
 
+                const auto num = (uint32_t)pos.size () / 3;
+
                 vertices.resize (currentNum + num);
                 for (uint32_t i = 0; i < num; ++i) {
-                    const auto &curPos = pos[i];
-                    auto       &vert   = vertices[i + currentNum];
+                    const auto *curPos = &pos[i * 3];
+                    const auto  vert   = matrix * vec4 (
+                        curPos[0], -curPos[1], curPos[2], 1.0f
+                    );
 
-                    vert.setX (curPos.x);
-                    vert.setY (-curPos.y);
-                    vert.setZ (curPos.z);
+                    vertices[i + currentNum].setValue (
+                        vert.x, vert.y, vert.z
+                    );
                 }
             }
 
@@ -494,7 +798,7 @@ static void loadConvexNode (
         for (auto n = 0; n < nodeCount; ++n) {
             loadConvexNode (
                 nodes, meshes, accessors, views, buffers,
-                currentNode, vertices
+                node.children[n], matrix, vertices
             );
         }
     }
@@ -537,15 +841,13 @@ static void loadConvexMeshFromGLB (
         const auto  accessors = model.accessors.data ();
         const auto  views = model.bufferViews.data ();
         const auto  buffers = model.buffers.data ();
-        const auto &scene = model.scenes[model.defaultScene];
-        const auto  nodeCount = scene.nodes.size ();
+        const auto &root = model.scenes[model.defaultScene];
+        const auto  nodeCount = root.nodes.size ();
 
         for (auto n = 0; n < nodeCount; ++n) {
             loadConvexNode (
-                model.nodes.data(), model.meshes.data(),
-                model.accessors.data(), model.bufferViews.data(),
-                model.buffers.data(),
-                n, vertices
+                nodes, meshes, accessors, views, buffers,
+                root.nodes[n], mat4 (1.0f), vertices
             );
         }
     }
@@ -555,27 +857,177 @@ static void loadConvexMeshFromGLB (
     // --------------------------------------------------------------
 }
 
+static btCollisionShape *loadConvexHull (
+    const std::string &modelName
+) {
+    btAlignedObjectArray<btVector3> vertices;
+    loadConvexMeshFromGLB (modelName, vertices);
+
+    const bool hasVertices = vertices.size () > 0;
+    CHECK (hasVertices);
+
+    // Render meshes have far more vertices than the narrowphase needs,
+    // the hull library keeps the most extreme ones up to the budget
+    HullDesc    desc (QF_TRIANGLES, (uint32_t)vertices.size (), &vertices[0]);
+    HullLibrary library;
+    HullResult  hull;
+
+    desc.mMaxVertices = maxHullVertices;
+
+    const bool built = library.CreateConvexHull (desc, hull) == QE_OK;
+    CHECK (built);
+
+    auto shape = new btConvexHullShape (
+        &hull.m_OutputVertices[0].getX (),
+        hull.mNumOutputVertices
+    );
+    library.ReleaseResult (hull);
+
+    return shape;
+}
+
 }
 
 namespace Scene {
 
+static uint32_t loadModel (
+    const std::string &modelName,
+    Scene             *scene
+) {
+    const auto cached = scene->modelCache.find (modelName);
+    if (cached != scene->modelCache.end ())
+        return cached->second;
+
+    const auto modelIndex = (uint32_t)scene->models.size ();
+    scene->models.emplace_back ();
+
+    // Prefer the baked model, the glTF file is only parsed without an
+    // up to date one. Hashing the file is still much cheaper than
+    // parsing it and decoding its textures.
+    auto &model = scene->models[modelIndex];
+    const auto baked = Bake::loadModel (
+        "models/" + modelName + ".hkm",
+        Bake::hashFile ("models/" + modelName + ".glb"),
+        &model, scene
+    );
+    if (!baked)
+        Object::loadModelFromGLB (modelName, &model, scene);
+
+    // Reserve the heap ranges now, so templates can be built right
+    // away. The data itself is uploaded with the next frame.
+    {
+        const auto vertexCount = (uint32_t)model.vertices.size ();
+        const auto indexCount  = (uint32_t)model.indices.size ();
+
+        const bool fitsVertices = Heap::alloc (vertexCount, &scene->vertexHeap, &model.vertexRange);
+        const bool fitsIndices  = Heap::alloc (indexCount, &scene->indexHeap, &model.indexRange);
+        CHECK (fitsVertices);
+        CHECK (fitsIndices);
+
+        scene->pendingUploads.push_back (modelIndex);
+    }
+
+    model.templateCount = 0;
+    for (auto &base : model.materialOverrides)
+        base = -1;
+    model.materialOverrides[Object::DefaultMaterial] = model.materialBase;
+
+    scene->modelCache.emplace (modelName, modelIndex);
+    return modelIndex;
+}
+
+static uint32_t loadMaterialOverride (
+    const Object::MaterialOverride  materialOverride,
+    Model                          *model,
+    Scene                          *scene
+) {
+    auto &base = model->materialOverrides[materialOverride];
+    if (base >= 0)
+        return (uint32_t)base;
+
+    base = allocMaterials (model->materialCount, scene);
+
+    auto &materials = scene->materials;
+    for (uint32_t m = 0; m < model->materialCount; ++m) {
+        auto &material = materials[base + m];
+
+        material = materials[model->materialBase + m];
+        Object::applyMaterialOverride (materialOverride, &material);
+    }
+
+    return (uint32_t)base;
+}
+
+// Transform slots stay relative to the model, every instance has its
+// own range of them starting at Instance::transBase
+static void instantiateNode (
+    const Node     &modelNode,
+    const Model    &model,
+    const uint32_t  materialBase,
+    Node           *node
+) {
+    node->relative     = modelNode.relative;
+    node->dynamicTrans = modelNode.dynamicTrans;
+
+    node->primitives = modelNode.primitives;
+    for (auto &primitive : node->primitives) {
+        primitive.dynamicMaterial += materialBase;
+        primitive.vertexOffset    += model.vertexRange.offset;
+
+        for (uint32_t l = 0; l < primitive.lodCount; ++l)
+            primitive.lods[l].indexOffset += model.indexRange.offset;
+    }
+
+    const auto childCount = modelNode.children.size ();
+    node->children.resize (childCount);
+    for (size_t c = 0; c < childCount; ++c) {
+        instantiateNode (
+            modelNode.children[c], model,
+            materialBase, &node->children[c]
+        );
+    }
+}
+
 void loadTemplate (
     const std::string                &modelName,
     const Object::CollisionShapeInfo &collisionInfo,
+    const Object::MaterialOverride    materialOverride,
     const uint32_t                    templateIndex,
     Scene                            *templates
 ) {
+    auto &temp = templates->templates[templateIndex];
+
     // --------------------------------------------------------------
     // LOAD MODEL START
     // --------------------------------------------------------------
 
-    loadTemplateFromGLB (
-        modelName, templates->nextDynTrans,
-        &templates->vertices, &templates->indices,
-        &templates->nextDynTrans,
-        &templates->templates[templateIndex],
-        templates
-    );
+    // Geometry and textures are shared between all templates using the
+    // same model, only overridden materials are not
+    {
+        const auto modelIndex   = loadModel (modelName, templates);
+        auto      &model        = templates->models[modelIndex];
+        const auto materialBase = loadMaterialOverride (
+            materialOverride, &model, templates
+        );
+        const auto nodeCount    = model.nodes.size ();
+
+        temp.nodes.resize (nodeCount);
+        for (size_t n = 0; n < nodeCount; ++n) {
+            instantiateNode (
+                model.nodes[n], model,
+                materialBase, &temp.nodes[n]
+            );
+        }
+
+        model.templateCount += 1;
+        temp.model           = modelIndex;
+        temp.numDynTrans     = model.numDynTrans;
+        temp.minExtent       = model.minExtent;
+        temp.maxExtent       = model.maxExtent;
+        temp.dequantize      = Object::dequantization (
+            model.minExtent, model.maxExtent
+        );
+    }
 
     // --------------------------------------------------------------
     // LOAD MODEL END
@@ -585,8 +1037,6 @@ void loadTemplate (
     // INITIALIZE COLLISION SHAPE START
     // --------------------------------------------------------------
 
-    auto &temp = templates->templates[templateIndex];
-
     switch (collisionInfo.type) {
     case Object::Box:
     {
@@ -602,6 +1052,22 @@ void loadTemplate (
         temp.shape = new btSphereShape(1.5f);
         break;
     case Object::Convex:
+    {
+        // Hulls come from a separate collision model if one is given,
+        // and are shared between all templates using the same model
+        const auto &shapeModel = collisionInfo.shapeModel.empty ()
+            ? modelName : collisionInfo.shapeModel;
+        auto cached = templates->shapeCache.find (shapeModel);
+
+        if (cached == templates->shapeCache.end ()) {
+            cached = templates->shapeCache.emplace (
+                shapeModel, Object::loadConvexHull (shapeModel)
+            ).first;
+        }
+
+        temp.shape = cached->second;
+    }
+        break;
     default:
         CHECK (false);
         break;
@@ -612,4 +1078,67 @@ void loadTemplate (
     // --------------------------------------------------------------
 }
 
-}
\ No newline at end of file
+void unloadTemplate (
+    const uint32_t  templateIndex,
+    Scene          *scene
+) {
+    auto       &temp       = scene->templates[templateIndex];
+    const auto  modelIndex = temp.model;
+    auto       &model      = scene->models[modelIndex];
+
+    // Hull shapes are shared through the shape cache
+    bool sharedShape = false;
+    for (const auto &cached : scene->shapeCache)
+        sharedShape = sharedShape || cached.second == temp.shape;
+    if (!sharedShape)
+        delete temp.shape;
+
+    temp.nodes.clear ();
+    temp.shape = nullptr;
+
+    model.templateCount -= 1;
+    if (model.templateCount > 0)
+        return;
+
+    // --------------------------------------------------------------
+    // EVICT MODEL START
+    // --------------------------------------------------------------
+
+    // Geometry ranges, materials of every override and texture layers
+    // go back to their free lists
+    Heap::release (model.vertexRange, &scene->vertexHeap);
+    Heap::release (model.indexRange, &scene->indexHeap);
+    model.vertexRange = {};
+    model.indexRange  = {};
+    model.nodes.clear ();
+    model.vertices.clear ();
+    model.indices.clear ();
+
+    for (auto &base : model.materialOverrides) {
+        if (base >= 0)
+            releaseMaterials ((uint32_t)base, model.materialCount, scene);
+        base = -1;
+    }
+    for (const auto &slot : model.textures)
+        releaseTexture (slot, scene);
+    model.textures.clear ();
+
+    auto &pending = scene->pendingUploads;
+    pending.erase (
+        std::remove (pending.begin (), pending.end (), modelIndex),
+        pending.end ()
+    );
+
+    for (auto it = scene->modelCache.begin (); it != scene->modelCache.end (); ++it) {
+        if (it->second == modelIndex) {
+            scene->modelCache.erase (it);
+            break;
+        }
+    }
+
+    // --------------------------------------------------------------
+    // EVICT MODEL END
+    // --------------------------------------------------------------
+}
+
+}
@@ -1,170 +1,538 @@
 //
 // Created by benja on 4/28/2018.
 //
+#include <iostream>
+
 #include "jojo_physics.hpp"
 #include "jojo_level.hpp"
+#include "jojo_profile.hpp"
 
-namespace Physics {
-
-static void compactCollisionArray (
-    btAlignedObjectArray<Collision> &collisions
-) {
-    const auto num      = collisions.size ();
-    int        lastFree = -1;
+#if BT_THREADSAFE
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#endif
 
-    for (int i = 0; i < num; i++) {
-        auto &coll = collisions[i];
+namespace Physics {
 
-        if (!coll.sticky) {
-            coll.active = false;
-            continue;
-        }
+static Physics *contactPhysics = nullptr;
 
-        if (lastFree < 0)
-            continue;
+static const uint64_t fnvOffsetBasis = 0xCBF29CE484222325ull;
+static const uint64_t fnvPrime       = 0x100000001B3ull;
 
-        auto &last = collisions[lastFree];
-        last.active = true;
-        last.sticky = true;
-        last.obj    = coll.obj;
-        coll.active = false;
-        coll.sticky = false;
-        coll.obj    = nullptr;
+static void hashBytes (
+    const void *data,
+    size_t      size,
+    uint64_t   *hash
+) {
+    const auto bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i) {
+        *hash ^= bytes[i];
+        *hash *= fnvPrime;
     }
 }
 
-static void collisionCallback (
-    btDynamicsWorld                 *world,
-    btScalar                      /* timeStep */
+static void hashVector (
+    const btVector3 &vector,
+    uint64_t        *hash
 ) {
-    const auto dp = world->getDispatcher ();
-    const auto numManifold = dp->getNumManifolds ();
-    auto       physics = (Physics *)(world->getWorldUserInfo ());
-    auto      &collisions = physics->collisionArray;
-    int        nextFreeCollision = 0;
-    compactCollisionArray (collisions);
+    const btScalar xyz[] = { vector.x (), vector.y (), vector.z () };
+    hashBytes (xyz, sizeof (xyz), hash);
+}
 
-    for (int i = 0; i < numManifold; ++i) {
-        const auto manif = dp->getManifoldByIndexInternal (i);
-        const auto body0 = btRigidBody::upcast (manif->getBody0 ());
-        const auto body1 = btRigidBody::upcast (manif->getBody1 ());
+// Only contacts of the player with another instance are gameplay
+// events, level geometry has no instance slot
+static bool playerContact (
+    const btPersistentManifold *manifold,
+    const ContactPhase          phase,
+    ContactEvent               *event
+) {
+    if (contactPhysics == nullptr || contactPhysics->instances == nullptr)
+        return false;
 
-        if (body0->getUserPointer () == nullptr)
-            continue;
-        if (body1->getUserPointer () == nullptr)
-            continue;
+    const auto slot0 = manifold->getBody0 ()->getUserIndex ();
+    const auto slot1 = manifold->getBody1 ()->getUserIndex ();
+    if (slot0 < 0 || slot1 < 0)
+        return false;
 
-        const auto inst0 = (Scene::Instance *)(body0->getUserPointer ());
-        const auto inst1 = (Scene::Instance *)(body1->getUserPointer ());
-        const auto type0 = inst0->type;
-        const auto type1 = inst1->type;
+    const auto &instances = *contactPhysics->instances;
+    const auto  type0     = instances.type[instances.dense[slot0]];
+    const auto  type1     = instances.type[instances.dense[slot1]];
+    if (type0 != Scene::PlayerInstance && type1 != Scene::PlayerInstance)
+        return false;
 
-        if (type0 != Scene::PlayerInstance && type1 != Scene::PlayerInstance)
-            continue;
+    const auto slot = type0 != Scene::PlayerInstance ? slot0 : slot1;
+
+    event->obj.slot       = (uint32_t)slot;
+    event->obj.generation = instances.generation[slot];
+    event->type           = type0 != Scene::PlayerInstance ? type0 : type1;
+    event->phase          = phase;
+    return true;
+}
+
+static void contactStarted (
+    btPersistentManifold * const &manifold
+) {
+    // Most contacts are props among themselves, those return before
+    // the profiler takes its lock
+    ContactEvent event;
+    if (!playerContact (manifold, ContactStarted, &event))
+        return;
 
-        // --------------------------------------------------------------
-        // STORE COLLISION START
-        // --------------------------------------------------------------
+    Profile::Scope scope (Profile::CollisionCallback);
+    Queue::push (event, &contactPhysics->contacts);
+}
 
-        const auto collNum = collisions.size ();
-        Collision *coll = nullptr;
+static void contactEnded (
+    btPersistentManifold * const &manifold
+) {
+    ContactEvent event;
+    if (!playerContact (manifold, ContactEnded, &event))
+        return;
 
-        for (; nextFreeCollision < collNum; nextFreeCollision++) {
-            if (!collisions[nextFreeCollision].active) {
-                coll = &collisions[nextFreeCollision];
-                break;
-            }
-        }
+    Profile::Scope scope (Profile::CollisionCallback);
+    Queue::push (event, &contactPhysics->contacts);
+}
 
-        // No collision space left anymore
-        if (coll == nullptr)
-            break;
+struct WakeCallback : btBroadphaseAabbCallback {
+    bool process (const btBroadphaseProxy *proxy) override {
+        const auto object = (btCollisionObject *)proxy->m_clientObject;
+        if (object->getActivationState () == ISLAND_SLEEPING)
+            object->activate ();
+        return true;
+    }
+};
 
-        coll->active = true;
-        coll->obj = type0 != Scene::PlayerInstance ? inst0 : inst1;
+struct CullPolicy : btDbvt::ICollide {
+    Scene::Instances *instances;
 
-        switch (coll->obj->type) {
-        case Scene::PortalInstance:
-        case Scene::LethalInstance:
-            coll->sticky = true;
-            break;
-        case Scene::NonLethalInstance:
-            break;
-        case Scene::PlayerInstance:
-        default:
-            CHECK (false);
-            break;
-        }
+    void Process (const btDbvtNode *leaf) override {
+        const auto proxy  = (const btBroadphaseProxy *)leaf->data;
+        const auto object = (const btCollisionObject *)proxy->m_clientObject;
+        const auto slot   = object->getUserIndex ();
 
-        // --------------------------------------------------------------
-        // STORE COLLISION END
-        // --------------------------------------------------------------
+        // Level geometry has no instance slot
+        if (slot >= 0)
+            instances->visible[instances->dense[slot]] = 1;
     }
-}
+};
 
 void alloc (
-    Physics *physics
+    const uint32_t  threads,
+    Physics        *physics
 ) {
     physics->collisionConfig      = new btDefaultCollisionConfiguration();
-    physics->dispatcher           = new btCollisionDispatcher (physics->collisionConfig);
     physics->overlappingPairCache = new btDbvtBroadphase ();
-    physics->solver               = new btSequentialImpulseConstraintSolver ();
-    physics->solver->setRandSeed (0xDEADBEEF);
-    physics->world = new btDiscreteDynamicsWorld (
-        physics->dispatcher, physics->overlappingPairCache,
-        physics->solver, physics->collisionConfig
-    );
+    physics->scheduler            = nullptr;
+
+#if BT_THREADSAFE
+    if (threads > 1) {
+        // Bullet runs its parallel loops on whatever scheduler is set
+        physics->scheduler = new Tasks::Scheduler (threads);
+        btSetTaskScheduler (physics->scheduler);
+
+        const auto solverPool = new btConstraintSolverPoolMt (
+            physics->scheduler->getMaxNumThreads ()
+        );
+        physics->dispatcher = new btCollisionDispatcherMt (physics->collisionConfig);
+        physics->solver     = solverPool;
+        physics->world      = new btDiscreteDynamicsWorldMt (
+            physics->dispatcher, physics->overlappingPairCache,
+            solverPool, nullptr, physics->collisionConfig
+        );
+    }
+#else
+    if (threads > 1)
+        std::cerr << "Bullet is not thread safe, physics runs on one thread" << std::endl;
+#endif
+
+    if (physics->scheduler == nullptr) {
+        const auto solver = new btSequentialImpulseConstraintSolver ();
+        solver->setRandSeed (0xDEADBEEF);
+
+        physics->dispatcher = new btCollisionDispatcher (physics->collisionConfig);
+        physics->solver     = solver;
+        physics->world      = new btDiscreteDynamicsWorld (
+            physics->dispatcher, physics->overlappingPairCache,
+            solver, physics->collisionConfig
+        );
+    }
 
-    physics->world->setInternalTickCallback (collisionCallback, (void *)physics);
     physics->world->setGravity (btVector3 (0, 0, 0));
 
-    physics->collisionArray.clear ();
-    physics->collisionArray.resize (64, { nullptr, false, false });
+    auto &solverInfo = physics->world->getSolverInfo ();
+    solverInfo.m_numIterations = solverIterations;
+    solverInfo.m_solverMode   &= ~SOLVER_RANDMIZE_ORDER;
+    physics->instances = nullptr;
+    physics->frozenBodies.clear ();
+    physics->lodCursor = 0;
+
+    Queue::init (&physics->contacts);
+    contactPhysics          = physics;
+    gContactStartedCallback = contactStarted;
+    gContactEndedCallback   = contactEnded;
 }
 
 void free (
     Physics *physics
 ) {
-    physics->collisionArray.clear ();
+    // Deleting the world releases the remaining manifolds, which would
+    // report their contacts as ended
+    if (contactPhysics == physics) {
+        contactPhysics          = nullptr;
+        gContactStartedCallback = nullptr;
+        gContactEndedCallback   = nullptr;
+    }
+
     delete physics->world;
     delete physics->solver;
     delete physics->overlappingPairCache;
     delete physics->dispatcher;
     delete physics->collisionConfig;
+    Queue::free (&physics->contacts);
+
+#if BT_THREADSAFE
+    if (physics->scheduler != nullptr) {
+        btSetTaskScheduler (btGetSequentialTaskScheduler ());
+        delete physics->scheduler;
+        physics->scheduler = nullptr;
+    }
+#endif
+}
+
+void applySleepPolicy (
+    btRigidBody               *body,
+    const Scene::InstanceType  type
+) {
+    const auto &policy = sleepPolicies[type];
+
+    body->setSleepingThresholds (policy.linearThreshold, policy.angularThreshold);
+    body->forceActivationState (policy.sleeps ? ACTIVE_TAG : DISABLE_DEACTIVATION);
+}
+
+void addInstanceBody (
+    btDynamicsWorld           *world,
+    btRigidBody               *body,
+    const Scene::InstanceType  type
+) {
+    world->addRigidBody (body, instanceGroups[type], instanceMasks[type]);
 }
 
 void addInstancesToWorld (
     Physics          *physics,
     Level::JojoLevel *level,
-    Scene::Instance  *instances,
-    size_t            numInstances
+    Scene::Instances *instances
 ) {
     auto world = physics->world;
 
     Level::addRigidBodies (level, physics->world);
-    for (auto i = 0; i < numInstances; i++)
-        world->addRigidBody (instances[i].body);
+    for (uint32_t i = 0; i < instances->count; i++)
+        addInstanceBody (world, instances->body[i], instances->type[i]);
+
+    // Bodies only know their slot, collisions and culling look the
+    // instance up in here
+    physics->instances = instances;
 }
 
 void removeInstancesFromWorld (
     Physics          *physics,
     Level::JojoLevel *level,
-    Scene::Instance  *instances,
-    size_t            numInstances
+    Scene::Instances *instances
 ) {
     const btVector3 zeroVector (0, 0, 0);
     auto            world = physics->world;
 
-    for (auto i = 0; i < numInstances; i++) {
-        auto body = instances[i].body;
+    for (uint32_t i = 0; i < instances->count; i++) {
+        auto body = instances->body[i];
 
         world->removeRigidBody (body);
         body->clearForces ();
         body->setLinearVelocity (zeroVector);
         body->setAngularVelocity (zeroVector);
+
+        // A reset starts every body awake, as it was spawned
+        body->activate (true);
     }
 
     Level::removeRigidBodies (level, world);
 }
 
+void saveCheckpoint (
+    const Physics          &physics,
+    const Scene::Instances &instances,
+    Checkpoint             *checkpoint
+) {
+    const auto count = instances.count;
+
+    checkpoint->handles.resize (count);
+    checkpoint->transforms.resize (count);
+    checkpoint->linearVelocities.resize (count);
+    checkpoint->angularVelocities.resize (count);
+    checkpoint->activationStates.resize (count);
+    checkpoint->deactivationTimes.resize (count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto body = instances.body[i];
+        const auto slot = instances.slot[i];
+
+        checkpoint->handles[i]           = { slot, instances.generation[slot] };
+        checkpoint->transforms[i]        = body->getWorldTransform ();
+        checkpoint->linearVelocities[i]  = body->getLinearVelocity ();
+        checkpoint->angularVelocities[i] = body->getAngularVelocity ();
+        checkpoint->activationStates[i]  = body->getActivationState ();
+        checkpoint->deactivationTimes[i] = body->getDeactivationTime ();
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto slot = instances.slot[i];
+        if (slot >= (uint32_t)physics.frozenBodies.size ())
+            continue;
+
+        const auto &entry = physics.frozenBodies[slot];
+        if (!entry.frozen || entry.generation != instances.generation[slot])
+            continue;
+
+        checkpoint->linearVelocities[i]  = entry.linearVelocity;
+        checkpoint->angularVelocities[i] = entry.angularVelocity;
+        checkpoint->activationStates[i]  = ACTIVE_TAG;
+        checkpoint->deactivationTimes[i] = 0;
+    }
+
+    // The multithreaded solver pool always starts from its own seed
+    checkpoint->solverSeed = 0;
+    if (physics.scheduler == nullptr) {
+        const auto solver = (btSequentialImpulseConstraintSolver *)physics.solver;
+        checkpoint->solverSeed = solver->getRandSeed ();
+    }
+}
+
+void restoreCheckpoint (
+    const Checkpoint  &checkpoint,
+    Physics           *physics,
+    Level::JojoLevel  *level,
+    Scene::Instances  *instances
+) {
+    thawAll (physics);
+    physics->lodCursor = 0;
+
+    // Removing every body frees all pairs and manifolds, an empty
+    // broadphase then starts over with fresh trees
+    removeInstancesFromWorld (physics, level, instances);
+    physics->overlappingPairCache->resetPool (physics->dispatcher);
+
+    for (uint32_t c = 0; c < (uint32_t)checkpoint.handles.size (); ++c) {
+        uint32_t index;
+        if (!Scene::lookup (*instances, checkpoint.handles[c], &index))
+            continue;
+
+        const auto &transform = checkpoint.transforms[c];
+        const auto  body      = instances->body[index];
+
+        body->setWorldTransform (transform);
+        body->setInterpolationWorldTransform (transform);
+        body->getMotionState ()->setWorldTransform (transform);
+        body->setLinearVelocity (checkpoint.linearVelocities[c]);
+        body->setAngularVelocity (checkpoint.angularVelocities[c]);
+        body->setInterpolationLinearVelocity (checkpoint.linearVelocities[c]);
+        body->setInterpolationAngularVelocity (checkpoint.angularVelocities[c]);
+        body->forceActivationState (checkpoint.activationStates[c]);
+        body->setDeactivationTime (checkpoint.deactivationTimes[c]);
+    }
+
+    physics->solver->reset ();
+    if (physics->scheduler == nullptr) {
+        const auto solver = (btSequentialImpulseConstraintSolver *)physics->solver;
+        solver->setRandSeed (checkpoint.solverSeed);
+    }
+
+    addInstancesToWorld (physics, level, instances);
+
+    // Removal reported the old contacts as ended
+    ContactEvent event;
+    while (Queue::pop (&physics->contacts, &event))
+        ;
+}
+
+uint64_t stateHash (
+    const Scene::Instances &instances
+) {
+    uint64_t hash = fnvOffsetBasis;
+
+    for (uint32_t i = 0; i < instances.count; ++i) {
+        const auto  body      = instances.body[i];
+        const auto &transform = body->getWorldTransform ();
+        const int   state     = body->getActivationState ();
+
+        hashVector (transform.getOrigin (), &hash);
+        for (int r = 0; r < 3; ++r)
+            hashVector (transform.getBasis ()[r], &hash);
+        hashVector (body->getLinearVelocity (), &hash);
+        hashVector (body->getAngularVelocity (), &hash);
+        hashBytes (&state, sizeof (state), &hash);
+    }
+
+    return hash;
+}
+
+void wakeNear (
+    Physics          *physics,
+    const btVector3  &center,
+    const float       radius
+) {
+    const btVector3 extent (radius, radius, radius);
+    WakeCallback    callback;
+
+    physics->overlappingPairCache->aabbTest (center - extent, center + extent, callback);
+}
+
+static void freeze (
+    btDynamicsWorld           *world,
+    btRigidBody               *body,
+    const Scene::InstanceType  type,
+    const uint32_t             generation,
+    FrozenBody                *entry
+) {
+    const auto &invInertia = body->getInvInertiaDiagLocal ();
+    const auto  inverse    = [] (btScalar x) { return x != 0 ? 1 / x : 0; };
+
+    entry->linearVelocity  = body->getLinearVelocity ();
+    entry->angularVelocity = body->getAngularVelocity ();
+    entry->mass            = inverse (body->getInvMass ());
+    entry->localInertia    = btVector3 (
+        inverse (invInertia.x ()),
+        inverse (invInertia.y ()),
+        inverse (invInertia.z ())
+    );
+    entry->generation      = generation;
+    entry->frozen          = true;
+
+    // Static bodies are kept out of the integration lists, which only
+    // happens when they are added
+    const btVector3 zeroVector (0, 0, 0);
+
+    world->removeRigidBody (body);
+    body->setMassProps (0, zeroVector);
+    body->setLinearVelocity (zeroVector);
+    body->setAngularVelocity (zeroVector);
+    addInstanceBody (world, body, type);
+}
+
+static void thaw (
+    btDynamicsWorld           *world,
+    btRigidBody               *body,
+    const Scene::InstanceType  type,
+    FrozenBody                *entry
+) {
+    world->removeRigidBody (body);
+    body->setMassProps (entry->mass, entry->localInertia);
+    body->updateInertiaTensor ();
+    body->setLinearVelocity (entry->linearVelocity);
+    body->setAngularVelocity (entry->angularVelocity);
+    applySleepPolicy (body, type);
+    addInstanceBody (world, body, type);
+
+    entry->frozen = false;
+}
+
+void updateLod (
+    Physics          *physics,
+    const btVector3  &center
+) {
+    auto      &instances = *physics->instances;
+    auto      &frozen    = physics->frozenBodies;
+    const auto count     = instances.count;
+    if (count == 0)
+        return;
+
+    if (frozen.size () < (int)instances.dense.size ())
+        frozen.resize ((int)instances.dense.size (), {});
+
+    const auto freeze2 = lodFreezeRadius * lodFreezeRadius;
+    const auto thaw2   = lodThawRadius * lodThawRadius;
+    const auto budget  = (count + lodBuckets - 1) / lodBuckets;
+
+    for (uint32_t k = 0; k < budget; ++k) {
+        const auto i = physics->lodCursor % count;
+        physics->lodCursor = i + 1;
+
+        const auto type = instances.type[i];
+        if (type == Scene::PlayerInstance || type == Scene::PortalInstance)
+            continue;
+
+        const auto body       = instances.body[i];
+        const auto slot       = instances.slot[i];
+        const auto generation = instances.generation[slot];
+        auto      &entry      = frozen[slot];
+        const auto isFrozen   = entry.frozen && entry.generation == generation;
+        const auto distance2  = (body->getWorldTransform ().getOrigin () - center).length2 ();
+
+        // Sleeping and static bodies cost nothing to begin with
+        if (!isFrozen && distance2 > freeze2 && body->isActive () && !body->isStaticObject ())
+            freeze (physics->world, body, type, generation, &entry);
+        else if (isFrozen && distance2 < thaw2)
+            thaw (physics->world, body, type, &entry);
+    }
+}
+
+void thawAll (
+    Physics          *physics
+) {
+    if (physics->instances == nullptr)
+        return;
+
+    auto &instances = *physics->instances;
+    auto &frozen    = physics->frozenBodies;
+
+    for (uint32_t i = 0; i < instances.count; ++i) {
+        const auto slot = instances.slot[i];
+        if (slot >= (uint32_t)frozen.size ())
+            continue;
+
+        auto &entry = frozen[slot];
+        if (entry.frozen && entry.generation == instances.generation[slot])
+            thaw (physics->world, instances.body[i], instances.type[i], &entry);
+        entry.frozen = false;
+    }
+}
+
+void cullInstances (
+    Physics          *physics,
+    const glm::mat4  &viewProjection
+) {
+    const auto &m = viewProjection;
+
+    // Gribb-Hartmann plane extraction for a [0, 1] depth range, the
+    // inside of every plane is n.x + o >= 0 as collideKDOP expects
+    const auto row = [&m] (int r) {
+        return glm::vec4 (m[0][r], m[1][r], m[2][r], m[3][r]);
+    };
+    const glm::vec4 planes[] = {
+        row (3) + row (0),
+        row (3) - row (0),
+        row (3) + row (1),
+        row (3) - row (1),
+        row (2),
+        row (3) - row (2)
+    };
+    const int planeCount = sizeof (planes) / sizeof (planes[0]);
+
+    btVector3 normals[planeCount];
+    btScalar  offsets[planeCount];
+    for (int p = 0; p < planeCount; ++p) {
+        normals[p] = btVector3 (planes[p].x, planes[p].y, planes[p].z);
+        offsets[p] = planes[p].w;
+    }
+
+    // The camera sits inside the player, which is always drawn
+    auto &instances = *physics->instances;
+    for (uint32_t i = 0; i < instances.count; ++i)
+        instances.visible[i] = instances.type[i] == Scene::PlayerInstance;
+
+    // Both the dynamic and the fixed set of the broadphase
+    const auto  broadphase = (btDbvtBroadphase *)physics->overlappingPairCache;
+    CullPolicy  policy;
+    policy.instances = &instances;
+    for (const auto &set : broadphase->m_sets)
+        btDbvt::collideKDOP (set.m_root, normals, offsets, planeCount, policy);
+}
+
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include <btBulletCollisionCommon.h>
 #include <btBulletDynamicsCommon.h>
 #include "jojo_level.hpp"
+#include "jojo_queue.hpp"
+#include "jojo_tasks.hpp"
 #include "jojo_scene.hpp"
 
 namespace Level {
@@ -17,25 +19,124 @@ namespace Physics {
 
 const float objectRestitution = 0.99f;
 
-struct Collision {
-    Scene::Instance *obj;
+// Fixed so that runs do not depend on Bullet's defaults
+const int solverIterations = 10;
 
-    bool active;
-    bool sticky;
+// Broadphase filter groups, above the ones Bullet uses for its own
+// default filtering. Pairs outside of each others masks never reach the
+// narrowphase, so the portal only ever touches the player.
+enum CollisionGroup : int {
+    LevelGroup  = 1 << 6,
+    PlayerGroup = 1 << 7,
+    PropGroup   = 1 << 8,
+    PortalGroup = 1 << 9
+};
+
+const int levelMask = PlayerGroup | PropGroup;
+
+// Indexed by Scene::InstanceType
+const int instanceGroups[] = {
+    PlayerGroup,
+    PropGroup,
+    PropGroup,
+    PortalGroup
+};
+const int instanceMasks[] = {
+    LevelGroup | PropGroup | PortalGroup,
+    LevelGroup | PlayerGroup | PropGroup,
+    LevelGroup | PlayerGroup | PropGroup,
+    PlayerGroup
+};
+
+// Bodies slower than the thresholds for two seconds fall asleep and
+// drop out of the step until a contact or the player wakes them up.
+// The player is steered every tick and never sleeps.
+struct SleepPolicy {
+    bool  sleeps;
+    float linearThreshold;
+    float angularThreshold;
+};
+
+// Indexed by Scene::InstanceType
+const SleepPolicy sleepPolicies[] = {
+    { false, 0.0f, 0.0f },
+    { true,  0.1f, 0.1f },
+    { true,  0.1f, 0.1f },
+    { true,  0.1f, 0.1f }
+};
+
+// Sleeping bodies closer to the player than this wake up before they
+// could be hit, so the first contact is not against a sleeping island
+const float wakeRadius = 8.0f;
+
+// Physics LOD. Moving bodies further from the player than the freeze
+// radius are turned static and keep their velocities aside, they get
+// both back once they are within the thaw radius again. Only one of
+// lodBuckets parts of the instances is checked per tick.
+const float    lodFreezeRadius = 60.0f;
+const float    lodThawRadius   = 50.0f;
+const uint32_t lodBuckets      = 8;
+
+struct FrozenBody {
+    btVector3  linearVelocity;
+    btVector3  angularVelocity;
+    btVector3  localInertia;
+    btScalar   mass;
+    uint32_t   generation;
+    bool       frozen;
+};
+
+void applySleepPolicy (
+    btRigidBody         *body,
+    Scene::InstanceType  type
+);
+
+// Adds an instance body with the filter of its type
+void addInstanceBody (
+    btDynamicsWorld     *world,
+    btRigidBody         *body,
+    Scene::InstanceType  type
+);
+
+enum ContactPhase : uint8_t {
+    ContactStarted,
+    ContactEnded
+};
+
+// The player started or stopped touching another instance
+struct ContactEvent {
+    Scene::InstanceHandle obj;
+    Scene::InstanceType   type;
+    ContactPhase          phase;
 };
 
 struct Physics {
     btDefaultCollisionConfiguration      *collisionConfig;
     btCollisionDispatcher                *dispatcher;
     btBroadphaseInterface                *overlappingPairCache;
-    btSequentialImpulseConstraintSolver  *solver;
+    btConstraintSolver                   *solver;
     btDiscreteDynamicsWorld              *world;
 
-    btAlignedObjectArray<Collision>       collisionArray;
+    // Only set for the multithreaded world
+    Tasks::Scheduler                     *scheduler;
+
+    // Filled from Bullet's contact callbacks during the step, drained
+    // by the gameplay once per tick
+    Queue::Mpsc<ContactEvent>            contacts;
+    Scene::Instances                     *instances;
+
+    // Indexed by instance slot, only valid for the generation it froze
+    btAlignedObjectArray<FrozenBody>      frozenBodies;
+    uint32_t                              lodCursor;
 };
 
+// Bullet reports contacts through globals, so only the most recently
+// allocated world gets contact events. More than one thread builds the
+// multithreaded world, which needs Bullet built with
+// BULLET2_MULTITHREADING and BT_THREADSAFE defined.
 void alloc (
-    Physics *physics
+    uint32_t  threads,
+    Physics  *physics
 );
 
 void free (
@@ -45,15 +146,76 @@ void free (
 void addInstancesToWorld (
     Physics          *physics,
     Level::JojoLevel *level,
-    Scene::Instance  *instances,
-    size_t            numInstances
+    Scene::Instances *instances
 );
 
 void removeInstancesFromWorld (
     Physics          *physics,
     Level::JojoLevel *level,
-    Scene::Instance  *instances,
-    size_t            numInstances
+    Scene::Instances *instances
+);
+
+// Simulation state of every instance body at one tick boundary, in
+// the dense order at the time it was taken
+struct Checkpoint {
+    std::vector<Scene::InstanceHandle> handles;
+    std::vector<btTransform>           transforms;
+    std::vector<btVector3>             linearVelocities;
+    std::vector<btVector3>             angularVelocities;
+    std::vector<int>                   activationStates;
+    std::vector<btScalar>              deactivationTimes;
+    unsigned long                      solverSeed;
+};
+
+// Frozen bodies are saved awake, with the velocities they keep aside
+void saveCheckpoint (
+    const Physics          &physics,
+    const Scene::Instances &instances,
+    Checkpoint             *checkpoint
+);
+
+// Puts every instance that still exists back into its saved state and
+// clears what Bullet remembers between ticks (pairs, manifolds, solver
+// state), so the world steps on as if it had been built fresh. Pending
+// contact events are dropped. Instances spawned since the checkpoint
+// keep their state, despawned ones are not brought back.
+void restoreCheckpoint (
+    const Checkpoint  &checkpoint,
+    Physics           *physics,
+    Level::JojoLevel  *level,
+    Scene::Instances  *instances
+);
+
+// 64 bit FNV-1a over the position, rotation, velocities and activation
+// of every instance body in dense order. Equal runs give equal hashes
+// on one build, padding and the w components are left out.
+uint64_t stateHash (
+    const Scene::Instances &instances
+);
+
+// Wakes every sleeping body whose AABB overlaps the cube around center
+void wakeNear (
+    Physics          *physics,
+    const btVector3  &center,
+    float             radius
+);
+
+// Freezes and thaws the next bucket of instances by their distance to
+// center. Only depends on the simulation, so replays freeze alike.
+void updateLod (
+    Physics          *physics,
+    const btVector3  &center
+);
+
+// Gives every frozen body its mass and velocities back
+void thawAll (
+    Physics          *physics
+);
+
+// Sets Instances::visible from the AABBs in the broadphase tree
+void cullInstances (
+    Physics          *physics,
+    const glm::mat4  &viewProjection
 );
 
 }
@@ -25,7 +25,8 @@ void JojoPipeline::createPipelineHelper (
     const std::vector<VkVertexInputAttributeDescription> &vertexAttributeDescriptions,
     bool testDepth,
     bool writeDepth,
-    bool alpha
+    bool alpha,
+    uint32_t pushConstantSize
 ) {
     descriptorSetLayout = descriptorLayout;
 
@@ -51,7 +52,16 @@ void JojoPipeline::createPipelineHelper (
 
     VkPipelineShaderStageCreateInfo shaderStages[] = {shaderStageCreateInfoVert, shaderStageCreateInfoFrag};
 
-    result = createPipelineLayout(engine->device, &descriptorSetLayout, &pipelineLayout);
+    std::vector<VkPushConstantRange> pushConstants;
+    if (pushConstantSize > 0) {
+        VkPushConstantRange range = {};
+        range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        range.offset = 0;
+        range.size = pushConstantSize;
+        pushConstants.push_back (range);
+    }
+
+    result = createPipelineLayout(engine->device, &descriptorSetLayout, &pipelineLayout, pushConstants);
     ASSERT_VULKAN (result);
 
     VkPipelineColorBlendAttachmentState cbas = {};
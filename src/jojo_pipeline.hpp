@@ -34,6 +34,7 @@ public:
         const std::vector<VkVertexInputAttributeDescription> &vertexAttributeDescriptions = {},
         bool testDepth = true,
         bool writeDepth = true,
-        bool alpha = false
+        bool alpha = false,
+        uint32_t pushConstantSize = 0
     );
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+
+#include "jojo_profile.hpp"
+
+namespace Profile {
+
+static const char *const sectionNames[SectionCount] = {
+    "step simulation",
+    "collision callback",
+    "update matrices",
+    "culling",
+    "queue instances"
+};
+
+static double   sectionTime[SectionCount]  = {};
+static uint32_t sectionCalls[SectionCount] = {};
+static uint32_t ticks                      = 0;
+
+// Physics and rendering run on their own threads
+static std::mutex mutex;
+
+Scope::Scope (
+    const Section section
+) : mSection (section),
+    mStart (std::chrono::high_resolution_clock::now ()) {}
+
+Scope::~Scope () {
+    const auto end = std::chrono::high_resolution_clock::now ();
+    std::lock_guard<std::mutex> lock (mutex);
+    sectionTime[mSection] += std::chrono::duration<double, std::milli> (
+        end - mStart
+    ).count ();
+    sectionCalls[mSection] += 1;
+}
+
+void endTick () {
+    std::lock_guard<std::mutex> lock (mutex);
+    ticks += 1;
+}
+
+uint32_t ticksSinceReport () {
+    std::lock_guard<std::mutex> lock (mutex);
+    return ticks;
+}
+
+void report (
+    std::ostream &out
+) {
+    std::lock_guard<std::mutex> lock (mutex);
+    if (ticks == 0)
+        return;
+
+    out << "profile over " << ticks << " ticks, ms per tick / per call:\n";
+    for (uint32_t s = 0; s < SectionCount; ++s) {
+        const auto calls = std::max (sectionCalls[s], 1u);
+
+        out << "  " << std::left << std::setw (20) << sectionNames[s]
+            << std::right << std::fixed << std::setprecision (3)
+            << std::setw (10) << sectionTime[s] / ticks
+            << std::setw (10) << sectionTime[s] / calls
+            << "  (" << sectionCalls[s] << " calls)\n";
+        sectionTime[s]  = 0.0;
+        sectionCalls[s] = 0;
+    }
+    out << std::flush;
+
+    ticks = 0;
+}
+
+}
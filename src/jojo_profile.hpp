@@ -0,0 +1,40 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace Profile {
+
+enum Section : uint8_t {
+    StepSimulation,
+    CollisionCallback,
+    UpdateMatrices,
+    Culling,
+    QueueInstances,
+    SectionCount
+};
+
+// Adds the lifetime of the scope to a section. Nested sections are
+// counted in both, the collision callback runs inside the step.
+class Scope {
+public:
+    explicit Scope (Section section);
+    ~Scope ();
+
+private:
+    Section                                        mSection;
+    std::chrono::high_resolution_clock::time_point mStart;
+};
+
+// Counts one tick. Sections do not all run once per tick, drawing
+// runs per frame, so the report also has the time per call.
+void endTick ();
+
+// Prints every section since the last report and starts over
+void report (
+    std::ostream &out
+);
+
+uint32_t ticksSinceReport ();
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+
+namespace Queue {
+
+// Unbounded multi producer, single consumer queue (Vyukov). Pushing is
+// one exchange and never waits on other producers, popping belongs to
+// one thread. An element that is still being linked in shows up on the
+// next pop, so the consumer may see it one drain late.
+template <typename T>
+struct Node {
+    std::atomic<Node<T> *> next;
+    T                      value;
+};
+
+template <typename T>
+struct Mpsc {
+    std::atomic<Node<T> *> head;
+    Node<T>               *tail;
+};
+
+template <typename T>
+void init (
+    Mpsc<T> *queue
+) {
+    auto stub = new Node<T> ();
+    stub->next.store (nullptr, std::memory_order_relaxed);
+    queue->head.store (stub, std::memory_order_relaxed);
+    queue->tail = stub;
+}
+
+template <typename T>
+void push (
+    const T &value,
+    Mpsc<T> *queue
+) {
+    auto node = new Node<T> ();
+    node->value = value;
+    node->next.store (nullptr, std::memory_order_relaxed);
+
+    const auto prev = queue->head.exchange (node, std::memory_order_acq_rel);
+    prev->next.store (node, std::memory_order_release);
+}
+
+template <typename T>
+bool pop (
+    Mpsc<T> *queue,
+    T       *value
+) {
+    const auto tail = queue->tail;
+    const auto next = tail->next.load (std::memory_order_acquire);
+    if (next == nullptr)
+        return false;
+
+    // The popped node becomes the new stub
+    *value      = next->value;
+    queue->tail = next;
+    delete tail;
+    return true;
+}
+
+// Drops everything left, no producer may push anymore
+template <typename T>
+void free (
+    Mpsc<T> *queue
+) {
+    T value;
+    while (pop (queue, &value))
+        ;
+
+    delete queue->tail;
+    queue->tail = nullptr;
+    queue->head.store (nullptr, std::memory_order_relaxed);
+}
+
+}
@@ -8,17 +8,42 @@
 
 namespace Replay {
 
-static const float PHYSICS_FRAMETIME = 6.7f;
-static const size_t PHYSICS_FPS = 150;
 static const size_t MAX_RECORD_TIME = 600;
-static const size_t MAX_SLICES = PHYSICS_FPS * MAX_RECORD_TIME;
 
-Recorder::Recorder (GLFWwindow *window) :
+// After a long stall only this many ticks are caught up, the rest of
+// the time is dropped instead of stalling the next frames as well
+static const double MAX_TICKS_PER_FRAME = 8.0;
+
+// Bit b of State::buttonState is the key at index b
+static const int RECORDED_KEYS[] = {
+    GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_R,
+    GLFW_KEY_F, GLFW_KEY_X, GLFW_KEY_Z, GLFW_KEY_Q, GLFW_KEY_E
+};
+static const int64_t RECORDED_KEY_COUNT = sizeof (RECORDED_KEYS) / sizeof (RECORDED_KEYS[0]);
+
+void sampleInput (GLFWwindow *window, State *state) {
+    state->buttonState = 0;
+    for (int64_t b = 0; b < RECORDED_KEY_COUNT; ++b) {
+        auto keyState = static_cast<int64_t>(glfwGetKey (window, RECORDED_KEYS[b])) & 1;
+        SET_BIT (state->buttonState, b, keyState);
+    }
+
+    double x, y;
+    glfwGetCursorPos (window, &x, &y);
+    state->mouseX = static_cast<float>(x);
+    state->mouseY = static_cast<float>(y);
+}
+
+Recorder::Recorder (uint32_t tickRate) :
     mState(RecorderState::Passthrough),
-    mStorage(MAX_SLICES),
-    mWindow(window),
+    mStorage(tickRate * MAX_RECORD_TIME),
+    mHashes(tickRate * MAX_RECORD_TIME),
+    mDiverged(false),
+    mCurrent{},
     mCurrentTick(0),
     mTicksRecorded(0),
+    mTickLength(1.0 / tickRate),
+    mAccumulator(0.0),
     mLastMeasurement (std::chrono::steady_clock::now ()),
     mResetFunc ([]() {}) {}
 
@@ -26,125 +51,83 @@ void Recorder::setResetFunc (const std::function<void ()> &func) {
     mResetFunc = func;
 }
 
-int Recorder::getKey (int key) {
-    auto &buttonState = mStorage[mCurrentTick].buttonState;
-    auto keyState = static_cast<int64_t>(glfwGetKey (mWindow, key)) & 1;
-
+void Recorder::sample (const State &live) {
     switch (mState) {
     case RecorderState::Recording:
-        switch (key) {
-        case GLFW_KEY_W:
-            SET_BIT (buttonState, 0, keyState);
-            break;
-        case GLFW_KEY_S:
-            SET_BIT (buttonState, 1, keyState);
-            break;
-        case GLFW_KEY_A:
-            SET_BIT (buttonState, 2, keyState);
-            break;
-        case GLFW_KEY_D:
-            SET_BIT (buttonState, 3, keyState);
-            break;
-        case GLFW_KEY_R:
-            SET_BIT (buttonState, 4, keyState);
-            break;
-        case GLFW_KEY_F:
-            SET_BIT (buttonState, 5, keyState);
-            break;
-        case GLFW_KEY_X:
-            SET_BIT (buttonState, 6, keyState);
-            break;
-        case GLFW_KEY_Z:
-            SET_BIT (buttonState, 7, keyState);
-            break;
-        case GLFW_KEY_Q:
-            SET_BIT (buttonState, 8, keyState);
-            break;
-        case GLFW_KEY_E:
-            SET_BIT (buttonState, 9, keyState);
-            break;
-        default:
-            break;
-        }
-        return static_cast<int>(keyState);
+        mStorage[mCurrentTick] = live;
+        mCurrent = live;
+        break;
     case RecorderState::Replaying:
     case RecorderState::ReplayFinished:
-        switch (key) {
-        case GLFW_KEY_W:
-            return GET_BIT (buttonState, 0);
-        case GLFW_KEY_S:
-            return GET_BIT (buttonState, 1);
-        case GLFW_KEY_A:
-            return GET_BIT (buttonState, 2);
-        case GLFW_KEY_D:
-            return GET_BIT (buttonState, 3);
-        case GLFW_KEY_R:
-            return GET_BIT (buttonState, 4);
-        case GLFW_KEY_F:
-            return GET_BIT (buttonState, 5);
-        case GLFW_KEY_X:
-            return GET_BIT (buttonState, 6);
-        case GLFW_KEY_Z:
-            return GET_BIT (buttonState, 7);
-        case GLFW_KEY_Q:
-            return GET_BIT (buttonState, 8);
-        case GLFW_KEY_E:
-            return GET_BIT (buttonState, 9);
-        default:
-            return 0;
-        }
+        mCurrent = mStorage[mCurrentTick];
+        break;
     default:
-        return static_cast<int>(keyState);
+        mCurrent = live;
     }
 }
 
-void Recorder::getCursorPos (double *x, double *y) {
-    auto &buttonState = mStorage[mCurrentTick];
-
+bool Recorder::diverged (uint64_t stateHash, size_t *tick) {
     switch (mState) {
     case RecorderState::Recording:
-        glfwGetCursorPos (mWindow, x, y);
-        buttonState.mouseX = static_cast<float>(*x);
-        buttonState.mouseY = static_cast<float>(*y);
-        break;
+        mHashes[mCurrentTick] = stateHash;
+        return false;
     case RecorderState::Replaying:
-    case RecorderState::ReplayFinished:
-        *x = buttonState.mouseX;
-        *y = buttonState.mouseY;
-        break;
+        if (mDiverged || mHashes[mCurrentTick] == stateHash)
+            return false;
+
+        mDiverged = true;
+        *tick     = mCurrentTick;
+        return true;
     default:
-        glfwGetCursorPos (mWindow, x, y);
+        return false;
     }
 }
 
+int Recorder::getKey (int key) {
+    for (int64_t b = 0; b < RECORDED_KEY_COUNT; ++b) {
+        if (RECORDED_KEYS[b] == key)
+            return static_cast<int>(GET_BIT (mCurrent.buttonState, b));
+    }
+    return 0;
+}
+
+void Recorder::getCursorPos (double *x, double *y) {
+    *x = mCurrent.mouseX;
+    *y = mCurrent.mouseY;
+}
+
 void Recorder::startRecording () {
     mCurrentTick = 0;
     mTicksRecorded = 0;
+    mAccumulator = 0.0;
     mLastMeasurement = std::chrono::steady_clock::now ();
     mState = RecorderState::Recording;
 }
 
 void Recorder::startReplay () {
     mCurrentTick = 0;
+    mAccumulator = 0.0;
     mLastMeasurement = std::chrono::steady_clock::now ();
+    mDiverged = false;
     mState = RecorderState::Replaying;
     mResetFunc ();
 }
 
 bool Recorder::nextTickReady () {
-    mLastMeasurement = std::chrono::steady_clock::now ();
-    auto delta = std::chrono::duration_cast<std::chrono::milliseconds> (
-        mLastMeasurement - mLastTickTime
-    ).count ();
-    return delta >= PHYSICS_FRAMETIME;
+    const auto now = std::chrono::steady_clock::now ();
+    mAccumulator += std::chrono::duration<double> (now - mLastMeasurement).count ();
+    mAccumulator  = std::min (mAccumulator, mTickLength * MAX_TICKS_PER_FRAME);
+    mLastMeasurement = now;
+    return mAccumulator >= mTickLength;
 }
 
 void Recorder::nextTick () {
-    mLastTickTime = mLastMeasurement;
+    mAccumulator -= mTickLength;
+    const auto maxSlices = mStorage.size ();
 
     switch (mState) {
     case RecorderState::Recording:
-        if (mCurrentTick + 1 < MAX_SLICES) {
+        if (mCurrentTick + 1 < maxSlices) {
             mCurrentTick += 1;
             mTicksRecorded += 1;
             return;
@@ -153,7 +136,7 @@ void Recorder::nextTick () {
         mState = RecorderState::Passthrough;
         return;
     case RecorderState::Replaying:
-        if (mCurrentTick + 1 == std::min (MAX_SLICES, mTicksRecorded))
+        if (mCurrentTick + 1 == std::min (maxSlices, mTicksRecorded))
             mState = RecorderState::ReplayFinished;
         else
             mCurrentTick += 1;
@@ -167,6 +150,15 @@ void Recorder::nextTick () {
     }    
 }
 
+float Recorder::tickLength () {
+    return (float)mTickLength;
+}
+
+// Fraction of a tick accumulated since the last one
+float Recorder::tickAlpha () {
+    return (float)(mAccumulator / mTickLength);
+}
+
 RecorderState Recorder::state () {
     return mState;
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <vector>
 #include <chrono>
 #include <functional>
@@ -21,27 +23,42 @@ enum RecorderState : uint8_t {
     Passthrough
 };
 
+// Main thread only, as GLFW wants it
+void sampleInput (GLFWwindow *window, State *state);
+
+// Input is recorded once per physics tick. Ticks are taken out of the
+// accumulated time at a fixed rate, the remainder is left for
+// interpolating render transforms between the last two ticks.
+// Everything but state () belongs to the physics thread.
 class Recorder {
 public:
-    Recorder (GLFWwindow *window);
+    Recorder (uint32_t tickRate);
     void setResetFunc (const std::function<void ()> &func);
+    void sample (const State &live);
+    // Recording keeps the hash of the state at the start of every tick,
+    // replaying compares against it. True once per replay, on the first
+    // tick that does not match.
+    bool diverged (uint64_t stateHash, size_t *tick);
     int getKey (int key);
     void getCursorPos (double *x, double *y);
     bool nextTickReady ();
     void nextTick ();
+    float tickLength ();
+    float tickAlpha ();
     void startRecording ();
     void startReplay ();
     RecorderState state ();
 
 private:
-    GLFWwindow                    *mWindow;
     std::vector<State>             mStorage;
-    RecorderState                  mState;
+    std::vector<uint64_t>          mHashes;
+    bool                           mDiverged;
+    std::atomic<RecorderState>     mState;
+    State                          mCurrent;
     size_t                         mCurrentTick;
     size_t                         mTicksRecorded;
-    std::chrono::time_point<
-        std::chrono::steady_clock
-    >                              mLastTickTime;
+    double                         mTickLength;
+    double                         mAccumulator;
     std::chrono::time_point<
         std::chrono::steady_clock
     >                              mLastMeasurement;
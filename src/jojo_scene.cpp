@@ -1,33 +1,145 @@
 //
 // Created by benja on 4/28/2018.
 //
+#include <algorithm>
+
 #include "jojo_physics.hpp"
 #include "jojo_vulkan_data.hpp"
 
 namespace Scene {
 
-void instantiate (
+// --------------------------------------------------------------
+// BODY POOL START
+// --------------------------------------------------------------
+
+static void *takeStorage (
+    const size_t         size,
+    std::vector<void *> *pool,
+    uint32_t            *misses
+) {
+    if (pool->empty ()) {
+        *misses += 1;
+        return btAlignedAlloc (size, 16);
+    }
+
+    const auto storage = pool->back ();
+    pool->pop_back ();
+    return storage;
+}
+
+static void warmPool (
+    const size_t         size,
+    const uint32_t       count,
+    std::vector<void *> *pool
+) {
+    pool->reserve (count);
+    while (pool->size () < count)
+        pool->push_back (btAlignedAlloc (size, 16));
+}
+
+// --------------------------------------------------------------
+// BODY POOL END
+// --------------------------------------------------------------
+
+void reserveInstances (
+    const uint32_t  capacity,
+    Scene          *scene
+) {
+    auto &instances = scene->instances;
+    auto &pool      = scene->bodyPool;
+
+    instances.templateId.reserve (capacity);
+    instances.transBase.reserve (capacity);
+    instances.type.reserve (capacity);
+    instances.body.reserve (capacity);
+    instances.visible.reserve (capacity);
+    instances.slot.reserve (capacity);
+    instances.previous.reserve (capacity);
+    instances.dense.reserve (capacity);
+    instances.generation.reserve (capacity);
+    instances.freeSlots.reserve (capacity);
+    instances.pendingDespawns.reserve (capacity);
+
+    warmPool (sizeof (btRigidBody), capacity, &pool.bodies);
+    warmPool (sizeof (btDefaultMotionState), capacity, &pool.motionStates);
+    pool.misses = 0;
+
+    // Enough slots for capacity instances of the largest template
+    uint32_t maxDynTrans = 1;
+    for (const auto &templ : scene->templates)
+        maxDynTrans = std::max (maxDynTrans, templ.numDynTrans);
+
+    Heap::init (capacity * maxDynTrans, &scene->transHeap);
+}
+
+void freeInstances (
+    Scene *scene
+) {
+    auto &instances = scene->instances;
+    auto &pool      = scene->bodyPool;
+
+    while (instances.count > 0) {
+        const auto slot = instances.slot[instances.count - 1];
+        despawn ({ slot, instances.generation[slot] }, nullptr, scene);
+    }
+
+    for (auto storage : pool.bodies)
+        btAlignedFree (storage);
+    for (auto storage : pool.motionStates)
+        btAlignedFree (storage);
+    pool.bodies.clear ();
+    pool.motionStates.clear ();
+}
+
+InstanceHandle instantiate (
     const mat4           &transform,
     const float           mass,
     const uint32_t        templateIndex,
     InstanceType          type,
-    Scene       *scene,
-    Instance             *instance
+    btDynamicsWorld      *world,
+    Scene                *scene
 ) {
-    const auto &templ = scene->templates[templateIndex];
+    const auto &templ     = scene->templates[templateIndex];
+    auto       &instances = scene->instances;
+    auto       &pool      = scene->bodyPool;
 
-    // Calculate start transform
-    JojoVulkanMesh::ModelTransformations modelTrans;
-    updateMatrices (
-        scene->templates.data (),
-        instance, 1, 0, false,
-        (uint8_t *)&modelTrans
-    );
-    modelTrans.model = transform * modelTrans.model;
+    Heap::Range trans = { 0, 0 };
+    if (templ.numDynTrans > 0 && !Heap::alloc (templ.numDynTrans, &scene->transHeap, &trans))
+        return invalidInstance;
+
+    // --------------------------------------------------------------
+    // SLOT START
+    // --------------------------------------------------------------
+
+    uint32_t slot;
+
+    if (!instances.freeSlots.empty ()) {
+        slot = instances.freeSlots.back ();
+        instances.freeSlots.pop_back ();
+    } else {
+        slot = (uint32_t)instances.dense.size ();
+        instances.dense.push_back (0);
+        instances.generation.push_back (0);
+    }
+
+    instances.dense[slot] = instances.count;
+    instances.count      += 1;
+
+    // --------------------------------------------------------------
+    // SLOT END
+    // --------------------------------------------------------------
+
+    // Calculate start transform, models are flattened into one node
+    // and the dequantization is not part of the body
+    mat4 relative (1.0f);
+    if (!templ.nodes.empty ())
+        relative = templ.nodes[0].relative;
 
     btTransform startTransform;
-    startTransform.setFromOpenGLMatrix (value_ptr (modelTrans.model));
-    instance->motionState = new btDefaultMotionState (startTransform);
+    startTransform.setFromOpenGLMatrix (value_ptr (transform * relative));
+    auto motionState = new (takeStorage (
+        sizeof (btDefaultMotionState), &pool.motionStates, &pool.misses
+    )) btDefaultMotionState (startTransform);
 
     btVector3 localInertia (0, 1, 0);
     btScalar bmass (mass);
@@ -35,95 +147,257 @@ void instantiate (
 
     auto info = btRigidBody::btRigidBodyConstructionInfo (
         mass,
-        instance->motionState,
+        motionState,
         scene->templates[templateIndex].shape,
         localInertia
     );
-    instance->body = new btRigidBody (info);
-    instance->body->setRestitution (Physics::objectRestitution);
-    instance->body->forceActivationState (DISABLE_DEACTIVATION);
-    instance->body->setUserPointer ((void *)instance);
-
-    auto &nextInstance   = scene->templates[templateIndex].nextInstance;
-    instance->templateId = templateIndex;
-    instance->instanceId = nextInstance;
-    instance->type       = type;
-    nextInstance += 1;
-}
-
-void cmdDrawInstances (
-    const VkCommandBuffer   cmd,
-    const VkPipelineLayout  pipelineLayout,
-    const JojoVulkanMesh   *data,
-    const Template         *templates,
-    const Instance         *instances,
-    const uint32_t          instanceCount
-) {
-    VkDeviceSize offsets = 0;
-    vkCmdBindVertexBuffers (
-        cmd, 0, 1, &data->vertex,
-        &offsets
-    );
-    vkCmdBindIndexBuffer (
-        cmd, data->index, 0,
-        VK_INDEX_TYPE_UINT32
+    auto body = new (takeStorage (
+        sizeof (btRigidBody), &pool.bodies, &pool.misses
+    )) btRigidBody (info);
+    body->setRestitution (Physics::objectRestitution);
+    Physics::applySleepPolicy (body, type);
+    body->setUserIndex ((int)slot);
+
+    instances.templateId.push_back (templateIndex);
+    instances.transBase.push_back (trans.offset);
+    instances.type.push_back (type);
+    instances.body.push_back (body);
+    instances.visible.push_back (1);
+    instances.slot.push_back (slot);
+    instances.previous.push_back (startTransform);
+
+    if (world != nullptr)
+        Physics::addInstanceBody (world, body, type);
+
+    return { slot, instances.generation[slot] };
+}
+
+template <typename T>
+static void swapRemove (
+    const uint32_t  index,
+    std::vector<T> *components
+) {
+    (*components)[index] = components->back ();
+    components->pop_back ();
+}
+
+void despawn (
+    const InstanceHandle  handle,
+    btDynamicsWorld      *world,
+    Scene                *scene
+) {
+    auto    &instances = scene->instances;
+    auto    &pool      = scene->bodyPool;
+    uint32_t index;
+
+    if (!lookup (instances, handle, &index))
+        return;
+
+    // --------------------------------------------------------------
+    // RETURN TO POOLS START
+    // --------------------------------------------------------------
+
+    auto body        = instances.body[index];
+    auto motionState = body->getMotionState ();
+    if (world != nullptr && body->isInWorld ())
+        world->removeRigidBody (body);
+
+    body->~btRigidBody ();
+    motionState->~btMotionState ();
+    pool.bodies.push_back (body);
+    pool.motionStates.push_back (motionState);
+
+    const auto &templ = scene->templates[instances.templateId[index]];
+    Heap::release (
+        { instances.transBase[index], templ.numDynTrans },
+        &scene->transHeap
     );
 
-    for (uint32_t i = 1; i < instanceCount; i++) {
-        const auto &inst = instances[i];
-        const auto &temp = templates[inst.templateId];
+    // --------------------------------------------------------------
+    // RETURN TO POOLS END
+    // --------------------------------------------------------------
 
-        // Only one instance for now
-        if (inst.instanceId > 0)
-            continue;
+    // The last instance moves into the hole
+    const auto last = instances.count - 1;
+    instances.dense[instances.slot[last]] = index;
+
+    swapRemove (index, &instances.templateId);
+    swapRemove (index, &instances.transBase);
+    swapRemove (index, &instances.type);
+    swapRemove (index, &instances.body);
+    swapRemove (index, &instances.visible);
+    swapRemove (index, &instances.slot);
+    swapRemove (index, &instances.previous);
+    instances.count = last;
+
+    instances.generation[handle.slot] += 1;
+    instances.freeSlots.push_back (handle.slot);
+}
+
+void despawnLater (
+    const InstanceHandle  handle,
+    Scene                *scene
+) {
+    scene->instances.pendingDespawns.push_back (handle);
+}
+
+void flushDespawns (
+    btDynamicsWorld      *world,
+    Scene                *scene
+) {
+    // Handles despawned twice fail the lookup the second time
+    auto &pending = scene->instances.pendingDespawns;
+    for (const auto handle : pending)
+        despawn (handle, world, scene);
+    pending.clear ();
+}
+
+void storePreviousTransforms (
+    Instances *instances
+) {
+    for (uint32_t i = 0; i < instances->count; i++)
+        instances->previous[i] = instances->body[i]->getWorldTransform ();
+}
+
+// --------------------------------------------------------------
+// SNAPSHOTS START
+// --------------------------------------------------------------
+
+// Set in middle when it holds a snapshot the reader has not seen
+static const uint32_t snapshotFresh = 4;
+
+void initSnapshots (
+    SnapshotBuffer *snapshots
+) {
+    for (auto &snapshot : snapshots->buffers) {
+        snapshot.count     = 0;
+        snapshot.hasPlayer = false;
+    }
+
+    snapshots->back  = 0;
+    snapshots->middle.store (1);
+    snapshots->front = 2;
+}
+
+void publishSnapshot (
+    const Instances                       &instances,
+    const InstanceHandle                   player,
+    std::chrono::steady_clock::time_point  time,
+    const float                            tickLength,
+    SnapshotBuffer                        *snapshots
+) {
+    auto &snapshot = snapshots->buffers[snapshots->back];
+
+    snapshot.time       = time;
+    snapshot.tickLength = tickLength;
+    snapshot.count      = instances.count;
+    snapshot.templateId.assign (instances.templateId.begin (), instances.templateId.end ());
+    snapshot.transBase.assign (instances.transBase.begin (), instances.transBase.end ());
+    snapshot.slot.assign (instances.slot.begin (), instances.slot.end ());
+    snapshot.visible.assign (instances.visible.begin (), instances.visible.end ());
+    snapshot.previous.assign (instances.previous.begin (), instances.previous.end ());
+
+    snapshot.current.resize (instances.count);
+    for (uint32_t i = 0; i < instances.count; i++)
+        snapshot.current[i] = instances.body[i]->getWorldTransform ();
+
+    snapshot.hasPlayer = lookup (instances, player, &snapshot.player);
+
+    // Release, so the reader sees the whole snapshot with the index
+    const auto previous = snapshots->middle.exchange (
+        snapshots->back | snapshotFresh, std::memory_order_acq_rel
+    );
+    snapshots->back = previous & ~snapshotFresh;
+}
 
-        for (const auto &node : temp.nodes)
-            data->drawNode (cmd, pipelineLayout, &node);
+const Snapshot &latestSnapshot (
+    SnapshotBuffer *snapshots
+) {
+    if (snapshots->middle.load (std::memory_order_relaxed) & snapshotFresh) {
+        const auto newest = snapshots->middle.exchange (
+            snapshots->front, std::memory_order_acq_rel
+        );
+        snapshots->front = newest & ~snapshotFresh;
     }
 
-    // Draw player instance last
-    for (const auto &node : templates[instances[0].templateId].nodes)
-        data->drawNode (cmd, pipelineLayout, &node);
+    return snapshots->buffers[snapshots->front];
+}
+
+void interpolatedMatrix (
+    const Snapshot &snapshot,
+    const uint32_t  index,
+    const float     alpha,
+    mat4           *matrix
+) {
+    const auto &from = snapshot.previous[index];
+    const auto &to   = snapshot.current[index];
+
+    btTransform trans;
+    trans.setOrigin (from.getOrigin ().lerp (to.getOrigin (), alpha));
+    trans.setRotation (from.getRotation ().slerp (to.getRotation (), alpha));
+    trans.getOpenGLMatrix (value_ptr (*matrix));
+}
+
+// --------------------------------------------------------------
+// SNAPSHOTS END
+// --------------------------------------------------------------
+
+bool lookup (
+    const Instances      &instances,
+    const InstanceHandle  handle,
+    uint32_t             *index
+) {
+    if (handle.slot >= instances.generation.size ())
+        return false;
+    if (instances.generation[handle.slot] != handle.generation)
+        return false;
+
+    *index = instances.dense[handle.slot];
+    return true;
 }
 
 static void updateNodeMatrices (
     const Node     &node,
     const mat4     &matrix,
-    const uint32_t  instanceId,
+    const mat4     &dequantize,
+    const uint32_t  transBase,
     const uint32_t  transAlignment,
     uint8_t        *transBuffer
 ) {
     const auto abs = node.relative * matrix;
 
-    // Only update one instance for now
-    if (node.dynamicTrans >= 0 && instanceId == 0) {
+    if (node.dynamicTrans >= 0) {
         auto trans = (JojoVulkanMesh::ModelTransformations *)(
-            transBuffer + transAlignment * node.dynamicTrans
+            transBuffer + transAlignment * (transBase + node.dynamicTrans)
         );
 
-        trans->model = abs;
+        // Normals are quantized separately and only see the node
+        trans->model = abs * dequantize;
         trans->normalMatrix = mat4 (inverseTranspose (mat3 (abs)));
     }
 
     for (const auto &child : node.children) {
         updateNodeMatrices (
-            child, abs, instanceId,
+            child, abs, dequantize, transBase,
             transAlignment, transBuffer
         );
     }
 }
 
 void updateMatrices (
-    const Template *templates,
-    const Instance *instances,
-    const uint32_t  instanceCount,
-    const uint32_t  transAlignment,
-    const bool      withPhysics,
-    uint8_t        *transBuffer
+    const Template  *templates,
+    const Snapshot  &snapshot,
+    const uint32_t   transAlignment,
+    const bool       withPhysics,
+    const float      alpha,
+    uint8_t         *transBuffer
 ) {
-    for (uint32_t i = 0; i < instanceCount; i++) {
-        const auto &inst = instances[i];
-        const auto &temp = templates[inst.templateId];
+    for (uint32_t i = 0; i < snapshot.count; i++) {
+        const auto &temp = templates[snapshot.templateId[i]];
+
+        // Culled instances keep their last transform
+        if (!snapshot.visible[i])
+            continue;
 
         // --------------------------------------------------------------
         // PHYSICS TRANSFORMATION BEGIN
@@ -131,11 +405,8 @@ void updateMatrices (
 
         mat4 physicsMatrix;
 
-        if (withPhysics) {
-            btTransform trans;
-            inst.body->getMotionState ()->getWorldTransform (trans);
-            trans.getOpenGLMatrix (glm::value_ptr (physicsMatrix));
-        }
+        if (withPhysics)
+            interpolatedMatrix (snapshot, i, alpha, &physicsMatrix);
 
         // --------------------------------------------------------------
         // PHYSICS TRANSFORMATION END
@@ -143,11 +414,92 @@ void updateMatrices (
 
         for (const auto &node : temp.nodes) {
             updateNodeMatrices (
-                node, physicsMatrix, inst.instanceId,
-                transAlignment, transBuffer
+                node, physicsMatrix, temp.dequantize,
+                snapshot.transBase[i], transAlignment, transBuffer
             );
         }
     }
 }
 
+uint32_t allocMaterials (
+    const uint32_t  count,
+    Scene          *scene
+) {
+    if (count == 0)
+        return 0;
+
+    Heap::Range range;
+    const bool  fits = Heap::alloc (count, &scene->materialHeap, &range);
+    CHECK (fits);
+
+    auto &materials = scene->materials;
+    if (materials.size () < range.offset + count)
+        materials.resize (range.offset + count);
+
+    scene->pendingMaterials.push_back (range);
+    return range.offset;
+}
+
+void releaseMaterials (
+    const uint32_t  base,
+    const uint32_t  count,
+    Scene          *scene
+) {
+    if (count == 0)
+        return;
+
+    Heap::release ({ base, count }, &scene->materialHeap);
+
+    auto &pending = scene->pendingMaterials;
+    pending.erase (
+        std::remove_if (pending.begin (), pending.end (), [base] (const Heap::Range &range) {
+            return range.offset == base;
+        }),
+        pending.end ()
+    );
+}
+
+void releaseTexture (
+    const TextureSlot &slot,
+    Scene             *scene
+) {
+    scene->textures[slot.bucket].freeLayers.push_back (slot.layer);
+}
+
+uint8_t *allocTexture (
+    const uint32_t  width,
+    const uint32_t  height,
+    Scene          *scene,
+    TextureSlot    *slot
+) {
+    // Only square power of two textures between 128 and 2048 pixels
+    if (width != height)
+        return nullptr;
+
+    for (uint32_t b = 0; b < textureBucketCount; ++b) {
+        if (width != minTextureSize << b)
+            continue;
+
+        auto          &bucket    = scene->textures[b];
+        const uint32_t layerSize = width * height * 4;
+
+        bucket.size      = width;
+        bucket.revision += 1;
+        slot->bucket     = b;
+
+        if (!bucket.freeLayers.empty ()) {
+            slot->layer = bucket.freeLayers.back ();
+            bucket.freeLayers.pop_back ();
+        } else {
+            bucket.data.resize (layerSize * (bucket.layers + 1));
+            slot->layer    = bucket.layers;
+            bucket.layers += 1;
+        }
+
+        return bucket.data.data () + layerSize * slot->layer;
+    }
+
+    return nullptr;
+}
+
 }
@@ -3,7 +3,10 @@
 //
 #pragma once
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <debug_trap.h>
 #define GLM_FORCE_RADIANS
@@ -15,27 +18,52 @@
 #include <btBulletDynamicsCommon.h>
 #include <vulkan/vulkan.h>
 
+#include "jojo_heap.hpp"
+
 #define CHECK(x) { if (!x) psnip_trap(); }
 
 class JojoVulkanMesh;
 
+namespace Rendering {
+class RenderQueue;
+}
+
 namespace Object {
 
 using namespace glm;
 
-struct Vertex {
+// Full precision vertex, only used while a model is loaded
+struct FloatVertex {
     vec3 pos;
     vec3 nml;
     vec2 tex;
 };
 
+// Vertex as stored in the geometry heaps. Positions are snorm16 within
+// the model bounds, see dequantization, normals are snorm8 and texture
+// coordinates half floats. The fourth components are padding.
+struct Vertex {
+    int16_t  pos[4];
+    int8_t   nml[4];
+    uint16_t tex[2];
+};
+
+// Detail levels per primitive, level 0 is the source mesh. Every level
+// is an index range into the shared index buffer over the same vertices.
+const uint32_t maxLods = 4;
+
+struct Lod {
+    uint32_t indexCount;
+    uint32_t indexOffset;
+};
+
 struct Primitive {
     uint32_t dynamicMVP;
     uint32_t dynamicMaterial;
 
-    uint32_t indexCount;
-    uint32_t indexOffset;
     uint32_t vertexOffset;
+    uint32_t lodCount;
+    Lod      lods[maxLods];
 };
 
 struct TransData {
@@ -44,6 +72,9 @@ struct TransData {
     mat4 projection;
 };
 
+// Materials are tightly packed into a storage buffer of
+// Scene::materialCapacity entries, draws index it with
+// DrawInfo::materialIndex
 struct Material {
     float ambient;
     float diffuse;
@@ -52,8 +83,8 @@ struct Material {
 
     float texture;
     float normal;
-    float param2;
-    float param3;
+    float textureBucket;
+    float normalBucket;
 };
 
 enum CollisionShapeType : uint8_t {
@@ -67,21 +98,64 @@ struct CollisionShapeInfo {
     std::string        shapeModel;
 };
 
+enum MaterialOverride : uint8_t {
+    DefaultMaterial,
+    PlayerMaterial,
+    PropMaterial,
+    GoalMaterial,
+    MaterialOverrideCount
+};
+
 };
 
 namespace Scene {
 
 using namespace glm;
 
-typedef std::vector<std::pair<
-    const std::string,
-    const Object::CollisionShapeInfo
->> TemplateInfo;
+struct TemplateFile {
+    std::string                model;
+    Object::CollisionShapeInfo collision;
+    Object::MaterialOverride   material;
+};
 
-typedef std::array<
-    uint8_t,
-    512 * 512 * 4
-> TextureData;
+typedef std::vector<TemplateFile> TemplateInfo;
+
+// Projected bounding radius, relative to half the screen height, below
+// which an instance switches to the next coarser level. Switching back
+// needs the size to move past the threshold by the hysteresis factor.
+const float lodScreenSize[Object::maxLods - 1] = { 0.25f, 0.1f, 0.04f };
+const float lodHysteresis = 0.15f;
+
+// Textures are grouped by size into one texture array per bucket,
+// bucket b holds square RGBA8 textures of minTextureSize << b pixels
+const uint32_t minTextureSize     = 128;
+const uint32_t textureBucketCount = 5;
+
+// Capacity of the geometry heaps in elements, 16 MiB of vertices and
+// 16 MiB of indices shared by every loaded model
+const uint32_t vertexHeapSize = 1u << 20;
+const uint32_t indexHeapSize  = 1u << 22;
+
+// Capacity of the material buffer in materials, 512 KiB. Materials
+// are sub-allocated like geometry, ranges written since the last
+// frame are uploaded with the next one.
+const uint32_t materialCapacity = 1u << 14;
+
+// Layers of evicted models go to freeLayers and are reused before the
+// bucket grows. The revision changes whenever a layer is handed out,
+// so rendering knows when to upload the bucket again.
+struct TextureBucket {
+    uint32_t              size;
+    uint32_t              layers;
+    uint32_t              revision;
+    std::vector<uint8_t>  data;
+    std::vector<uint32_t> freeLayers;
+};
+
+struct TextureSlot {
+    uint32_t bucket;
+    uint32_t layer;
+};
 
 struct Node {
     mat4                           relative;
@@ -91,10 +165,38 @@ struct Node {
     std::vector<Object::Primitive> primitives;
 };
 
+// Geometry, textures and materials of a single model file, shared by
+// every template that uses it. Transform slots, material indices and
+// geometry offsets of the nodes are relative to the model.
+struct Model {
+    std::vector<Node>  nodes;
+    uint32_t           numDynTrans;
+    uint32_t           templateCount;
+
+    // Geometry is kept on the CPU until it is uploaded into its
+    // ranges of the scene's geometry heaps
+    std::vector<Object::Vertex> vertices;
+    std::vector<uint32_t>       indices;
+    Heap::Range                 vertexRange;
+    Heap::Range                 indexRange;
+
+    uint32_t           materialBase;
+    uint32_t           materialCount;
+    int64_t            materialOverrides[Object::MaterialOverrideCount];
+
+    // Texture layers owned by the model, released on eviction
+    std::vector<TextureSlot> textures;
+
+    vec3               minExtent;
+    vec3               maxExtent;
+};
+
 struct Template {
     std::vector<Node>  nodes;
     btCollisionShape  *shape;
-    uint32_t           nextInstance;
+    uint32_t           numDynTrans;
+    uint32_t           model;
+    mat4               dequantize;
 
     vec3               minExtent;
     vec3               maxExtent;
@@ -107,62 +209,282 @@ enum InstanceType : uint8_t {
     PortalInstance
 };
 
-struct Instance {
-    uint32_t              instanceId;
-    uint32_t              templateId;
+// Stays valid while other instances come and go, the generation
+// tells a despawned instance apart from the next one in its slot
+struct InstanceHandle {
+    uint32_t              slot;
+    uint32_t              generation;
+};
+
+// Instances as dense component arrays, entry i of every array belongs
+// to the same instance, so per-tick systems walk them front to back.
+// Despawning moves the last instance into the hole, handles go through
+// the slot table and bodies carry their slot as user index.
+struct Instances {
+    uint32_t                    count;
+
+    // Components, indexed densely
+    std::vector<uint32_t>       templateId;
+    std::vector<uint32_t>       transBase;
+    std::vector<InstanceType>   type;
+    std::vector<btRigidBody *>  body;
+    std::vector<uint8_t>        visible;
+    std::vector<uint32_t>       slot;
+
+    // Body transform before the last physics tick
+    std::vector<btTransform>    previous;
+
+    // Slot table, indexed by InstanceHandle::slot
+    std::vector<uint32_t>       dense;
+    std::vector<uint32_t>       generation;
+    std::vector<uint32_t>       freeSlots;
+
+    // Despawns requested during the frame, applied between steps
+    std::vector<InstanceHandle> pendingDespawns;
+};
+
+// Returned when the transform slots are used up
+const InstanceHandle invalidInstance = { ~0u, 0 };
+
+// Aligned storage for bodies and motion states, constructed in place on
+// spawn and destructed on despawn, so bursts of spawns do not go
+// through the allocator once the pool is warm
+struct BodyPool {
+    std::vector<void *>         bodies;
+    std::vector<void *>         motionStates;
+    uint32_t                    misses;
+};
+
+// What rendering needs from one physics tick, dense like Instances at
+// the time of the tick. Rendering never touches bodies or Instances.
+struct Snapshot {
+    std::chrono::steady_clock::time_point time;
+    float                       tickLength;
+
+    uint32_t                    count;
+    std::vector<uint32_t>       templateId;
+    std::vector<uint32_t>       transBase;
+    std::vector<uint32_t>       slot;
+    std::vector<uint8_t>        visible;
+    std::vector<btTransform>    previous;
+    std::vector<btTransform>    current;
+
+    bool                        hasPlayer;
+    uint32_t                    player;
+};
 
-    InstanceType          type;
-    btRigidBody          *body;
-    btDefaultMotionState *motionState;
+// Lock-free handoff from the physics thread to rendering. The writer
+// fills back and swaps it with middle, the reader swaps front with
+// middle whenever middle holds a newer tick, neither ever waits.
+struct SnapshotBuffer {
+    Snapshot                    buffers[3];
+    std::atomic<uint32_t>       middle;
+    uint32_t                    back;
+    uint32_t                    front;
 };
 
 struct Scene {
+    std::vector<Model>            models;
+    std::unordered_map<
+        std::string,
+        uint32_t
+    >                             modelCache;
+    std::unordered_map<
+        std::string,
+        btCollisionShape *
+    >                             shapeCache;
+
     std::vector<Template>         templates;
-    std::vector<Instance>         instances;
+    Instances                     instances;
+    InstanceHandle                player;
+    BodyPool                      bodyPool;
+    Heap::FreeList                transHeap;
 
-    uint32_t                      numInstances;
-    uint32_t                      nextDynTrans;
-    uint32_t                      textureCount;
+    // Selected LOD per instance slot, only used by rendering
+    std::vector<uint32_t>         lods;
 
-    std::vector<uint32_t>         indices;
-    std::vector<Object::Vertex>   vertices;
+    Heap::FreeList                vertexHeap;
+    Heap::FreeList                indexHeap;
+    std::vector<uint32_t>         pendingUploads;
+
+    // Grows up to the highest allocated material, ranges are handed
+    // out by the material heap
     std::vector<Object::Material> materials;
-    std::vector<TextureData>      textures;
+    Heap::FreeList                materialHeap;
+    std::vector<Heap::Range>      pendingMaterials;
+
+    std::array<
+        TextureBucket,
+        textureBucketCount
+    >                             textures;
+    TextureSlot                   defaultTexture;
+    TextureSlot                   defaultNormal;
 };
 
+uint8_t *allocTexture (
+    uint32_t     width,
+    uint32_t     height,
+    Scene       *scene,
+    TextureSlot *slot
+);
+
+// Reserves count materials and returns the index of the first one,
+// they are uploaded with the next frame
+uint32_t allocMaterials (
+    uint32_t     count,
+    Scene       *scene
+);
+
+void releaseMaterials (
+    uint32_t     base,
+    uint32_t     count,
+    Scene       *scene
+);
+
+// Returns a layer to its bucket, the default slots are never released
+void releaseTexture (
+    const TextureSlot &slot,
+    Scene             *scene
+);
+
 void loadTemplate (
     const std::string                 &modelName,
     const Object::CollisionShapeInfo  &collisionInfo,
+    Object::MaterialOverride           materialOverride,
     uint32_t                           templateIndex,
     Scene                             *templates
 );
 
-void instantiate (
+// Drops a template, its model is evicted from the geometry heaps once
+// no template uses it anymore. Instances of the template must be gone.
+void unloadTemplate (
+    uint32_t                           templateIndex,
+    Scene                             *scene
+);
+
+// Sizes the instance arrays, the body pool and the transform slots
+// for capacity instances of the loaded templates. Needs the templates
+// and has to run before instantiating.
+void reserveInstances (
+    uint32_t              capacity,
+    Scene                *scene
+);
+
+// Destructs all instances and frees the pool storage, the bodies must
+// not be in a world anymore
+void freeInstances (
+    Scene                *scene
+);
+
+// Adds the body to the world if one is given. Fails with
+// invalidInstance once the transform slots are used up.
+InstanceHandle instantiate (
     const mat4           &transform,
     float                 mass,
     uint32_t              templateIndex,
     InstanceType          type,
-    Scene                *scene,
-    Instance             *instance
+    btDynamicsWorld      *world,
+    Scene                *scene
+);
+
+// Removes the body from the world if one is given and returns it and
+// its transform slots to the pools. The last instance takes over the
+// dense index, stale handles are ignored.
+void despawn (
+    InstanceHandle        handle,
+    btDynamicsWorld      *world,
+    Scene                *scene
+);
+
+// Safe anywhere in the frame, also from collision callbacks during a
+// step, the instance goes away in the next flushDespawns
+void despawnLater (
+    InstanceHandle        handle,
+    Scene                *scene
+);
+
+void flushDespawns (
+    btDynamicsWorld      *world,
+    Scene                *scene
 );
 
-void cmdDrawInstances (
-    const VkCommandBuffer   cmd,
-    const VkPipelineLayout  pipelineLayout,
-    const JojoVulkanMesh   *data,
+// Keeps the body transforms before a physics tick, so rendering can
+// interpolate between the last two ticks
+void storePreviousTransforms (
+    Instances            *instances
+);
+
+void initSnapshots (
+    SnapshotBuffer       *snapshots
+);
+
+// Physics thread, copies the instances into the back buffer and makes
+// it the newest snapshot
+void publishSnapshot (
+    const Instances      &instances,
+    InstanceHandle        player,
+    std::chrono::steady_clock::time_point time,
+    float                 tickLength,
+    SnapshotBuffer       *snapshots
+);
+
+// Render thread, the newest published snapshot. Stays valid until the
+// next call.
+const Snapshot &latestSnapshot (
+    SnapshotBuffer       *snapshots
+);
+
+// Body transform alpha of the way from the previous to the last tick
+void interpolatedMatrix (
+    const Snapshot       &snapshot,
+    uint32_t              index,
+    float                 alpha,
+    mat4                 *matrix
+);
+
+// Dense index of a live instance, false for despawned handles
+bool lookup (
+    const Instances      &instances,
+    InstanceHandle        handle,
+    uint32_t             *index
+);
+
+void queueInstances (
     const Template         *templates,
-    const Instance         *instances,
-    uint32_t                instanceCount
+    const Snapshot         &snapshot,
+    std::vector<uint32_t>  *lods,
+    uint32_t                transAlignment,
+    const uint8_t          *transBuffer,
+    const mat4             &view,
+    float                   projScale,
+    float                   farPlane,
+    uint32_t                pipeline,
+    Rendering::RenderQueue *queue
 );
 
 void updateMatrices (
-    const Template *templates,
-    const Instance *instances,
-    const uint32_t  instanceCount,
-    const uint32_t  transAlignment,
-    const bool      withPhysics,
-    uint8_t        *transBuffer
+    const Template  *templates,
+    const Snapshot  &snapshot,
+    const uint32_t   transAlignment,
+    const bool       withPhysics,
+    const float      alpha,
+    uint8_t         *transBuffer
 );
 
 }
 
+namespace Object {
+
+void loadModelFromGLB (
+    const std::string                 &modelName,
+    Scene::Model                      *sceneModel,
+    Scene::Scene                      *scene
+);
+
+// Maps quantized positions from [-1, 1] back into the model bounds
+mat4 dequantization (
+    const vec3                        &minExtent,
+    const vec3                        &maxExtent
+);
+
+}
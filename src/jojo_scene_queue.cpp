@@ -0,0 +1,120 @@
+// Instance drawing, kept apart from jojo_scene.cpp so the simulation
+// sources do not depend on the render queue and its Vulkan calls
+#include "jojo_scene.hpp"
+#include "jojo_vulkan_data.hpp"
+#include "Rendering/RenderQueue.h"
+
+namespace Scene {
+
+static uint32_t selectLod (
+    const uint32_t current,
+    const float    screenSize
+) {
+    auto lod = current;
+
+    while (lod + 1 < Object::maxLods
+           && screenSize < lodScreenSize[lod] * (1.0f - lodHysteresis))
+        lod += 1;
+    while (lod > 0
+           && screenSize > lodScreenSize[lod - 1] * (1.0f + lodHysteresis))
+        lod -= 1;
+
+    return lod;
+}
+
+static void queueNode (
+    const Node             &node,
+    const mat4             &view,
+    const uint32_t          transBase,
+    const uint32_t          lod,
+    const float             farPlane,
+    const uint32_t          pipeline,
+    const uint32_t          transAlignment,
+    const uint8_t          *transBuffer,
+    Rendering::RenderQueue *queue
+) {
+    if (node.dynamicTrans >= 0) {
+        const auto trans = (const JojoVulkanMesh::ModelTransformations *)(
+            transBuffer + transAlignment * (transBase + node.dynamicTrans)
+        );
+        const auto viewPos = view * trans->model[3];
+        const auto depth   = -viewPos.z / farPlane;
+
+        for (const auto &primitive : node.primitives) {
+            const auto &level = primitive.lods[std::min (lod, primitive.lodCount - 1)];
+
+            Rendering::DrawPacket packet = {};
+            packet.indexCount    = level.indexCount;
+            packet.firstIndex    = level.indexOffset;
+            packet.vertexOffset  = (int32_t)primitive.vertexOffset;
+            packet.transIndex    = transBase + primitive.dynamicMVP;
+            packet.materialIndex = primitive.dynamicMaterial;
+
+            queue->push (
+                Rendering::Pass::Opaque, pipeline,
+                depth, packet
+            );
+        }
+    }
+
+    for (const auto &child : node.children) {
+        queueNode (
+            child, view, transBase, lod, farPlane, pipeline,
+            transAlignment, transBuffer, queue
+        );
+    }
+}
+
+void queueInstances (
+    const Template         *templates,
+    const Snapshot         &snapshot,
+    std::vector<uint32_t>  *lods,
+    const uint32_t          transAlignment,
+    const uint8_t          *transBuffer,
+    const mat4             &view,
+    const float             projScale,
+    const float             farPlane,
+    const uint32_t          pipeline,
+    Rendering::RenderQueue *queue
+) {
+    // LODs are kept per slot, dense indices change with despawns
+    for (uint32_t i = 0; i < snapshot.count; i++) {
+        if (snapshot.slot[i] >= lods->size ())
+            lods->resize (snapshot.slot[i] + 1, 0);
+    }
+
+    for (uint32_t i = 0; i < snapshot.count; i++) {
+        const auto &temp = templates[snapshot.templateId[i]];
+        auto       &lod  = (*lods)[snapshot.slot[i]];
+
+        if (!snapshot.visible[i])
+            continue;
+
+        // --------------------------------------------------------------
+        // LOD SELECTION BEGIN
+        // --------------------------------------------------------------
+
+        {
+            const auto &origin = snapshot.current[i].getOrigin ();
+
+            const auto viewPos = view * vec4 (origin.x (), origin.y (), origin.z (), 1.0f);
+            const auto radius  = length (temp.maxExtent - temp.minExtent) * 0.5f;
+            const auto dist    = std::max (-viewPos.z, radius);
+
+            lod = selectLod (lod, radius * projScale / dist);
+        }
+
+        // --------------------------------------------------------------
+        // LOD SELECTION END
+        // --------------------------------------------------------------
+
+        for (const auto &node : temp.nodes) {
+            queueNode (
+                node, view, snapshot.transBase[i], lod, farPlane,
+                pipeline, transAlignment, transBuffer, queue
+            );
+        }
+    }
+}
+
+}
@@ -0,0 +1,433 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include "jojo_simplify.hpp"
+
+namespace Simplify {
+
+using namespace glm;
+
+// Symmetric 4x4 matrix, upper triangle row by row
+struct Quadric {
+    double a[10];
+};
+
+struct Collapse {
+    double   cost;
+    uint32_t from;
+    uint32_t to;
+};
+
+static void addPlane (
+    const dvec3 &normal,
+    const double distance,
+    Quadric     *quadric
+) {
+    const auto &n = normal;
+    const auto  d = distance;
+    auto       *a = quadric->a;
+
+    a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+    a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+    a[7] += n.z * n.z; a[8] += n.z * d;
+    a[9] += d * d;
+}
+
+static void addQuadric (
+    const Quadric &other,
+    Quadric       *quadric
+) {
+    for (uint32_t i = 0; i < 10; ++i)
+        quadric->a[i] += other.a[i];
+}
+
+static double evaluate (
+    const Quadric &q0,
+    const Quadric &q1,
+    const vec3    &position
+) {
+    double a[10];
+    for (uint32_t i = 0; i < 10; ++i)
+        a[i] = q0.a[i] + q1.a[i];
+
+    const double x = position.x;
+    const double y = position.y;
+    const double z = position.z;
+
+    return a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x
+         + a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y
+         + a[7] * z * z + 2.0 * a[8] * z
+         + a[9];
+}
+
+// Groups vertices with bit identical positions. Vertices of group g
+// are order[groupStart[g]] up to order[groupStart[g + 1]].
+static uint32_t weld (
+    const Object::FloatVertex *vertices,
+    const uint32_t             vertexCount,
+    std::vector<uint32_t>     *group,
+    std::vector<uint32_t>     *order,
+    std::vector<uint32_t>     *groupStart
+) {
+    order->resize (vertexCount);
+    std::iota (order->begin (), order->end (), 0);
+    std::sort (order->begin (), order->end (), [vertices] (uint32_t l, uint32_t r) {
+        const auto &a = vertices[l].pos;
+        const auto &b = vertices[r].pos;
+        if (a.x != b.x)
+            return a.x < b.x;
+        if (a.y != b.y)
+            return a.y < b.y;
+        return a.z < b.z;
+    });
+
+    group->resize (vertexCount);
+    groupStart->clear ();
+
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        const auto v = (*order)[i];
+        if (i == 0 || vertices[v].pos != vertices[(*order)[i - 1]].pos)
+            groupStart->push_back (i);
+        (*group)[v] = (uint32_t)groupStart->size () - 1;
+    }
+
+    groupStart->push_back (vertexCount);
+    return (uint32_t)groupStart->size () - 1;
+}
+
+// Rejects collapses that flip or flatten a remaining triangle
+static bool validCollapse (
+    const uint32_t               from,
+    const uint32_t               to,
+    const std::vector<vec3>     &positions,
+    const std::vector<uint32_t> &tris,
+    const std::vector<uint32_t> &adjStart,
+    const std::vector<uint32_t> &adj
+) {
+    for (uint32_t k = adjStart[from]; k < adjStart[from + 1]; ++k) {
+        const auto *tri = &tris[adj[k] * 3];
+
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+            continue;
+
+        vec3 before[3];
+        vec3 after[3];
+        for (uint32_t c = 0; c < 3; ++c) {
+            before[c] = positions[tri[c]];
+            after[c]  = positions[tri[c] == from ? to : tri[c]];
+        }
+
+        const auto n0 = cross (before[1] - before[0], before[2] - before[0]);
+        const auto n1 = cross (after[1] - after[0], after[2] - after[0]);
+        if (dot (n0, n1) <= 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+uint32_t simplify (
+    const Object::FloatVertex *vertices,
+    const uint32_t             vertexCount,
+    const uint32_t            *indices,
+    const uint32_t             indexCount,
+    const uint32_t             targetIndexCount,
+    const float                maxError,
+    uint32_t                  *outIndices
+) {
+    std::vector<uint32_t> group;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> groupStart;
+    const auto groupCount = weld (
+        vertices, vertexCount,
+        &group, &order, &groupStart
+    );
+
+    std::vector<vec3> positions (groupCount);
+    for (uint32_t g = 0; g < groupCount; ++g)
+        positions[g] = vertices[order[groupStart[g]]].pos;
+
+    // --------------------------------------------------------------
+    // WELDED TRIANGLES START
+    // --------------------------------------------------------------
+
+    // Winding relative to the vertex normals, used to pick vertex copies
+    // for the output faces. Every corner keeps a source vertex next to
+    // its group, which tells the UV side of a seam it belongs to.
+    std::vector<uint32_t> tris;
+    std::vector<uint32_t> corners;
+    double                orientation = 0.0;
+
+    tris.reserve (indexCount);
+    corners.reserve (indexCount);
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3) {
+        const uint32_t t[] = {
+            group[indices[i]],
+            group[indices[i + 1]],
+            group[indices[i + 2]]
+        };
+
+        if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2])
+            continue;
+
+        tris.insert (tris.end (), t, t + 3);
+        corners.insert (corners.end (), indices + i, indices + i + 3);
+
+        const auto &p = positions;
+        const auto  n = cross (p[t[1]] - p[t[0]], p[t[2]] - p[t[0]]);
+        orientation += dot (n,
+            vertices[indices[i]].nml
+            + vertices[indices[i + 1]].nml
+            + vertices[indices[i + 2]].nml
+        );
+    }
+
+    // --------------------------------------------------------------
+    // WELDED TRIANGLES END
+    // --------------------------------------------------------------
+
+    // --------------------------------------------------------------
+    // LOCK BORDERS START
+    // --------------------------------------------------------------
+
+    // Open borders and non-manifold edges are kept in place, otherwise
+    // holes in the mesh grow with every collapse
+    std::vector<uint8_t> locked (groupCount, 0);
+
+    {
+        std::vector<uint64_t> edges;
+        edges.reserve (tris.size ());
+
+        for (size_t t = 0; t < tris.size (); t += 3) {
+            for (uint32_t e = 0; e < 3; ++e) {
+                const uint64_t a = tris[t + e];
+                const uint64_t b = tris[t + (e + 1) % 3];
+                edges.push_back (a < b ? (a << 32) | b : (b << 32) | a);
+            }
+        }
+
+        std::sort (edges.begin (), edges.end ());
+
+        for (size_t i = 0; i < edges.size ();) {
+            size_t j = i;
+            while (j < edges.size () && edges[j] == edges[i])
+                ++j;
+
+            if (j - i != 2) {
+                locked[edges[i] >> 32]        = 1;
+                locked[edges[i] & 0xFFFFFFFF] = 1;
+            }
+            i = j;
+        }
+    }
+
+    // --------------------------------------------------------------
+    // LOCK BORDERS END
+    // --------------------------------------------------------------
+
+    // --------------------------------------------------------------
+    // LOCK SEAMS START
+    // --------------------------------------------------------------
+
+    // Positions whose triangles use more than one texture coordinate
+    // sit on a UV seam. Moving them would drag one side's UVs across
+    // the other.
+    {
+        std::vector<uint32_t> first (groupCount, ~0u);
+
+        for (size_t i = 0; i < tris.size (); ++i) {
+            const auto g = tris[i];
+            if (first[g] == ~0u)
+                first[g] = corners[i];
+            else if (vertices[corners[i]].tex != vertices[first[g]].tex)
+                locked[g] = 1;
+        }
+    }
+
+    // --------------------------------------------------------------
+    // LOCK SEAMS END
+    // --------------------------------------------------------------
+
+    std::vector<Quadric> quadrics (groupCount);
+
+    for (size_t t = 0; t < tris.size (); t += 3) {
+        const dvec3 p0 (positions[tris[t]]);
+        const dvec3 p1 (positions[tris[t + 1]]);
+        const dvec3 p2 (positions[tris[t + 2]]);
+
+        auto         normal = cross (p1 - p0, p2 - p0);
+        const double len    = length (normal);
+        if (len <= 0.0)
+            continue;
+
+        normal /= len;
+        const double distance = -dot (normal, p0);
+
+        for (uint32_t c = 0; c < 3; ++c)
+            addPlane (normal, distance, &quadrics[tris[t + c]]);
+    }
+
+    // --------------------------------------------------------------
+    // COLLAPSE PASSES START
+    // --------------------------------------------------------------
+
+    // Every pass sorts all edge collapses by cost and applies the
+    // cheapest ones that do not share triangles with an earlier collapse
+    // of the same pass, so the validity checks see current geometry
+    std::vector<uint32_t> collapse (groupCount);
+    std::vector<uint32_t> replacement (groupCount);
+    std::vector<uint32_t> adjStart;
+    std::vector<uint32_t> adj;
+    std::vector<uint32_t> adjFill;
+    std::vector<uint8_t>  touched;
+    std::vector<Collapse> candidates;
+
+    while (tris.size () > targetIndexCount) {
+        const auto triCount = (uint32_t)tris.size () / 3;
+
+        adjStart.assign (groupCount + 1, 0);
+        for (const auto v : tris)
+            adjStart[v + 1] += 1;
+        for (uint32_t g = 0; g < groupCount; ++g)
+            adjStart[g + 1] += adjStart[g];
+
+        adj.resize (tris.size ());
+        adjFill.assign (adjStart.begin (), adjStart.end () - 1);
+        for (uint32_t i = 0; i < (uint32_t)tris.size (); ++i)
+            adj[adjFill[tris[i]]++] = i / 3;
+
+        candidates.clear ();
+        for (size_t t = 0; t < tris.size (); t += 3) {
+            for (uint32_t e = 0; e < 3; ++e) {
+                const auto a = tris[t + e];
+                const auto b = tris[t + (e + 1) % 3];
+
+                if (!locked[a]) {
+                    const auto cost = evaluate (quadrics[a], quadrics[b], positions[b]);
+                    candidates.push_back ({ cost, a, b });
+                }
+                if (!locked[b]) {
+                    const auto cost = evaluate (quadrics[a], quadrics[b], positions[a]);
+                    candidates.push_back ({ cost, b, a });
+                }
+            }
+        }
+
+        std::sort (candidates.begin (), candidates.end (), [] (const Collapse &l, const Collapse &r) {
+            return l.cost < r.cost;
+        });
+
+        std::iota (collapse.begin (), collapse.end (), 0);
+        touched.assign (groupCount, 0);
+
+        const uint32_t neededTris = triCount - targetIndexCount / 3;
+        uint32_t       removedTris = 0;
+        uint32_t       collapsed   = 0;
+
+        for (const auto &c : candidates) {
+            if (c.cost > maxError)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+            if (!validCollapse (c.from, c.to, positions, tris, adjStart, adj))
+                continue;
+
+            collapse[c.from] = c.to;
+            addQuadric (quadrics[c.from], &quadrics[c.to]);
+
+            for (uint32_t k = adjStart[c.from]; k < adjStart[c.from + 1]; ++k) {
+                const auto  t   = adj[k] * 3;
+                const auto *tri = &tris[t];
+
+                touched[tri[0]] = 1;
+                touched[tri[1]] = 1;
+                touched[tri[2]] = 1;
+
+                // From is off any seam, so the corner of to in a
+                // removed triangle is on the side of all its triangles
+                for (uint32_t e = 0; e < 3; ++e) {
+                    if (tri[e] == c.to) {
+                        replacement[c.from] = corners[t + e];
+                        removedTris += 1;
+                    }
+                }
+            }
+
+            collapsed += 1;
+            if (removedTris >= neededTris)
+                break;
+        }
+
+        if (collapsed == 0)
+            break;
+
+        size_t write = 0;
+        for (size_t t = 0; t < tris.size (); t += 3) {
+            const auto a = collapse[tris[t]];
+            const auto b = collapse[tris[t + 1]];
+            const auto c = collapse[tris[t + 2]];
+
+            if (a == b || b == c || a == c)
+                continue;
+
+            for (uint32_t e = 0; e < 3; ++e) {
+                const auto g = tris[t + e];
+                corners[write] = collapse[g] == g ? corners[t + e] : replacement[g];
+                tris[write++]  = collapse[g];
+            }
+        }
+        tris.resize (write);
+        corners.resize (write);
+    }
+
+    // --------------------------------------------------------------
+    // COLLAPSE PASSES END
+    // --------------------------------------------------------------
+
+    // --------------------------------------------------------------
+    // PICK VERTEX COPIES START
+    // --------------------------------------------------------------
+
+    const float sign  = orientation < 0.0 ? -1.0f : 1.0f;
+    uint32_t    count = 0;
+
+    for (size_t t = 0; t < tris.size (); t += 3) {
+        const auto &p = positions;
+        const auto  n = sign * cross (
+            p[tris[t + 1]] - p[tris[t]],
+            p[tris[t + 2]] - p[tris[t]]
+        );
+
+        // Only copies on the corner's side of a UV seam are candidates,
+        // the normal decides between copies split for hard edges
+        for (uint32_t c = 0; c < 3; ++c) {
+            const auto  g       = tris[t + c];
+            const auto &tex     = vertices[corners[t + c]].tex;
+            uint32_t    best    = corners[t + c];
+            float       bestDot = -std::numeric_limits<float>::max ();
+
+            for (uint32_t k = groupStart[g]; k < groupStart[g + 1]; ++k) {
+                const auto  v = order[k];
+                if (vertices[v].tex != tex)
+                    continue;
+
+                const float d = dot (vertices[v].nml, n);
+                if (d > bestDot) {
+                    best    = v;
+                    bestDot = d;
+                }
+            }
+
+            outIndices[count++] = best;
+        }
+    }
+
+    // --------------------------------------------------------------
+    // PICK VERTEX COPIES END
+    // --------------------------------------------------------------
+
+    return count;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include "jojo_scene.hpp"
+
+namespace Simplify {
+
+// Quadric error edge collapse (Garland and Heckbert) on an indexed
+// triangle list. Vertices are welded by position so normal seams do
+// not block collapses, open borders and UV seams are kept in place.
+// Only existing vertices are referenced by the result, every output
+// corner picks the copy of its position on its side of a UV seam whose
+// normal fits the new face best.
+//
+// Collapses stop at targetIndexCount or once the cheapest collapse
+// costs more than maxError (sum of squared plane distances).
+// Returns the number of indices written to outIndices, which needs
+// room for indexCount indices.
+uint32_t simplify (
+    const Object::FloatVertex *vertices,
+    uint32_t                   vertexCount,
+    const uint32_t            *indices,
+    uint32_t                   indexCount,
+    uint32_t                   targetIndexCount,
+    float                      maxError,
+    uint32_t                  *outIndices
+);
+
+}
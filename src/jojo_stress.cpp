@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <cmath>
+
+#include "jojo_stress.hpp"
+
+namespace Stress {
+
+using namespace glm;
+
+// Static, light, medium and heavy bodies
+static const float masses[] = { 0.0f, 0.3f, 1.0f, 3.0f };
+
+// One in lethalRatio instances is lethal, the rest are not
+static const uint32_t lethalRatio = 10;
+
+// SplitMix64, std distributions differ between standard libraries
+static uint64_t nextRandom (
+    uint64_t *state
+) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static float randomFloat (
+    uint64_t *state
+) {
+    return (float)(nextRandom (state) >> 40) / (float)(1ull << 24);
+}
+
+void populate (
+    const Field                 &field,
+    const std::vector<uint32_t> &templates,
+    Scene::Scene                *scene
+) {
+    if (templates.empty ())
+        return;
+
+    uint64_t   state = field.seed;
+    const auto side  = std::max (
+        (uint32_t)std::ceil (std::cbrt ((double)field.count)), 1u
+    );
+    const auto half  = (float)(side - 1) * field.spacing * 0.5f;
+
+    for (uint32_t i = 0; i < field.count; ++i) {
+        const vec3 cell (
+            (float)(i % side),
+            (float)((i / side) % side),
+            (float)(i / (side * side))
+        );
+
+        // Every draw is a statement of its own, so the sequence does
+        // not depend on the evaluation order of the compiler
+        const auto jitterX = randomFloat (&state) - 0.5f;
+        const auto jitterY = randomFloat (&state) - 0.5f;
+        const auto jitterZ = randomFloat (&state) - 0.5f;
+        const auto pitch   = randomFloat (&state) * radians (360.0f);
+        const auto yaw     = randomFloat (&state) * radians (360.0f);
+        const auto templ   = nextRandom (&state) % templates.size ();
+        const auto mass    = nextRandom (&state) % (sizeof (masses) / sizeof (masses[0]));
+        const auto lethal  = nextRandom (&state) % lethalRatio == 0;
+
+        const vec3 position = field.origin + field.spacing * (
+            vec3 (cell.x, cell.y, -cell.z)
+            + vec3 (jitterX, jitterY, jitterZ) * 0.5f
+        ) - vec3 (half, half, 0.0f);
+
+        const auto transform = translate (position)
+            * rotate (yaw, vec3 (0.0f, 1.0f, 0.0f))
+            * rotate (pitch, vec3 (1.0f, 0.0f, 0.0f));
+
+        Scene::instantiate (
+            transform, masses[mass], templates[templ],
+            lethal ? Scene::LethalInstance : Scene::NonLethalInstance,
+            nullptr, scene
+        );
+    }
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "jojo_scene.hpp"
+
+namespace Stress {
+
+// Instances are laid out on a grid of cubic cells, centered on the
+// origin in x and y and growing into -z, each jittered within its cell
+struct Field {
+    uint32_t   count;
+    uint32_t   seed;
+    glm::vec3  origin;
+    float      spacing;
+};
+
+// Instantiates field.count instances of the given templates into the
+// scene, with mixed masses and instance types. The same seed
+// always gives the same field, on every platform.
+void populate (
+    const Field                 &field,
+    const std::vector<uint32_t> &templates,
+    Scene::Scene                *scene
+);
+
+}
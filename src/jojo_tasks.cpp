@@ -0,0 +1,153 @@
+#include <algorithm>
+
+#include "jojo_tasks.hpp"
+
+namespace Tasks {
+
+// Set while a thread runs loop chunks, nested loops stay on it
+static thread_local bool insideLoop = false;
+
+Scheduler::Scheduler (
+    const uint32_t threads
+) : btITaskScheduler ("heikousen"),
+    mRunning (true),
+    mGeneration (0),
+    mPending (0),
+    mBody (nullptr),
+    mEnd (0),
+    mGrainSize (1),
+    mNext (0) {
+    const auto count = std::min (std::max (threads, 1u), (uint32_t)BT_MAX_THREAD_COUNT);
+
+    mNumThreads = (int)count;
+    for (uint32_t i = 1; i < count; ++i)
+        mWorkers.emplace_back (&Scheduler::workerLoop, this, i - 1);
+}
+
+Scheduler::~Scheduler () {
+    {
+        std::lock_guard<std::mutex> lock (mMutex);
+        mRunning = false;
+    }
+    mWake.notify_all ();
+
+    for (auto &worker : mWorkers)
+        worker.join ();
+}
+
+int Scheduler::getMaxNumThreads () const {
+    return (int)mWorkers.size () + 1;
+}
+
+int Scheduler::getNumThreads () const {
+    return mNumThreads;
+}
+
+void Scheduler::setNumThreads (
+    const int numThreads
+) {
+    std::lock_guard<std::mutex> lock (mMutex);
+    mNumThreads = std::min (std::max (numThreads, 1), getMaxNumThreads ());
+}
+
+void Scheduler::parallelFor (
+    const int                  iBegin,
+    const int                  iEnd,
+    const int                  grainSize,
+    const btIParallelForBody  &body
+) {
+    run (iBegin, iEnd, grainSize, [&body] (int begin, int end) {
+        body.forLoop (begin, end);
+    });
+}
+
+btScalar Scheduler::parallelSum (
+    const int                  iBegin,
+    const int                  iEnd,
+    const int                  grainSize,
+    const btIParallelSumBody  &body
+) {
+    std::mutex sumMutex;
+    btScalar   sum = 0;
+
+    run (iBegin, iEnd, grainSize, [&body, &sumMutex, &sum] (int begin, int end) {
+        const auto part = body.sumLoop (begin, end);
+        std::lock_guard<std::mutex> lock (sumMutex);
+        sum += part;
+    });
+
+    return sum;
+}
+
+void Scheduler::run (
+    const int                              begin,
+    const int                              end,
+    const int                              grainSize,
+    const std::function<void (int, int)>  &body
+) {
+    const auto grain = std::max (grainSize, 1);
+
+    if (insideLoop || mNumThreads <= 1 || end - begin <= grain) {
+        body (begin, end);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock (mMutex);
+        mBody      = &body;
+        mEnd       = end;
+        mGrainSize = grain;
+        mNext.store (begin, std::memory_order_relaxed);
+        mPending     = (uint32_t)mWorkers.size ();
+        mGeneration += 1;
+    }
+    mWake.notify_all ();
+
+    work ();
+
+    // Every worker has to see the loop before the next one replaces it
+    std::unique_lock<std::mutex> lock (mMutex);
+    mDone.wait (lock, [this] { return mPending == 0; });
+    mBody = nullptr;
+}
+
+void Scheduler::work () {
+    insideLoop = true;
+
+    for (;;) {
+        const auto start = mNext.fetch_add (mGrainSize, std::memory_order_relaxed);
+        if (start >= mEnd)
+            break;
+
+        (*mBody) (start, std::min (start + mGrainSize, mEnd));
+    }
+
+    insideLoop = false;
+}
+
+void Scheduler::workerLoop (
+    const uint32_t index
+) {
+    uint64_t seen = 0;
+
+    for (;;) {
+        std::unique_lock<std::mutex> lock (mMutex);
+        mWake.wait (lock, [this, seen] { return !mRunning || mGeneration != seen; });
+        if (!mRunning)
+            return;
+
+        seen = mGeneration;
+        const bool active = (int)index + 1 < mNumThreads;
+        lock.unlock ();
+
+        if (active)
+            work ();
+
+        lock.lock ();
+        mPending -= 1;
+        if (mPending == 0)
+            mDone.notify_one ();
+    }
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <LinearMath/btThreads.h>
+
+namespace Tasks {
+
+// Bullet's parallel loops on a fixed set of worker threads. The calling
+// thread works along, chunks of grainSize are claimed from a shared
+// counter, so threads that finish early take over what is left. Loops
+// started from inside a loop run on the calling thread.
+class Scheduler : public btITaskScheduler {
+public:
+    explicit Scheduler (uint32_t threads);
+    ~Scheduler () override;
+
+    int getMaxNumThreads () const override;
+    int getNumThreads () const override;
+    void setNumThreads (int numThreads) override;
+
+    void parallelFor (
+        int                        iBegin,
+        int                        iEnd,
+        int                        grainSize,
+        const btIParallelForBody  &body
+    ) override;
+
+    btScalar parallelSum (
+        int                        iBegin,
+        int                        iEnd,
+        int                        grainSize,
+        const btIParallelSumBody  &body
+    ) override;
+
+private:
+    void run (
+        int                                    begin,
+        int                                    end,
+        int                                    grainSize,
+        const std::function<void (int, int)>  &body
+    );
+    void work ();
+    void workerLoop (uint32_t index);
+
+    std::vector<std::thread>               mWorkers;
+    std::mutex                             mMutex;
+    std::condition_variable                mWake;
+    std::condition_variable                mDone;
+    bool                                   mRunning;
+    uint64_t                               mGeneration;
+    uint32_t                               mPending;
+    int                                    mNumThreads;
+
+    // The current loop, only written while no worker is inside work ()
+    const std::function<void (int, int)>  *mBody;
+    int                                    mEnd;
+    int                                    mGrainSize;
+    std::atomic<int>                       mNext;
+};
+
+}
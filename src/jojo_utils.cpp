@@ -4,6 +4,7 @@
 
 #include "jojo_utils.hpp"
 
+#include <algorithm>
 #include <fstream>
 
 #include "INIReader.h"
@@ -37,7 +38,16 @@ Config Config::readFromFile(std::string filename) {
     float gamma = static_cast<float>(reader.GetReal ("window", "gamma", 1.22));
     int dofTaps = reader.GetInteger("postproc", "doftaps", 16);
     auto map = reader.Get("gameplay", "map", "2");
-    return Config(width, height, 25, 2, vsync, fullscreen, refreshrate, gamma, 1.0, map, dofTaps);
+    Config config(width, height, 25, 2, vsync, fullscreen, refreshrate, gamma, 1.0, map, dofTaps);
+    config.cullingEnabled = reader.GetBoolean("render", "culling", true);
+    config.instanceCapacity = (uint32_t)reader.GetInteger("scene", "capacity", 1024);
+    config.physicsRate = std::max ((uint32_t)reader.GetInteger("physics", "rate", 150), 1u);
+    config.physicsThreads = std::max ((uint32_t)reader.GetInteger("physics", "threads", 1), 1u);
+    config.deterministic = reader.GetBoolean("physics", "deterministic", true);
+    config.stressCount = (uint32_t)reader.GetInteger("stress", "count", 0);
+    config.stressSeed = (uint32_t)reader.GetInteger("stress", "seed", 1);
+    config.profilingEnabled = reader.GetBoolean("stress", "profile", false);
+    return config;
 }
 
 Config::Config(uint32_t width,
@@ -47,6 +47,26 @@ public:
     float dofFocalWidth    = 6.0f;
     int   dofTaps          = 16;
 
+    bool  cullingEnabled   = true;
+
+    // Instances the scene preallocates bodies and transform slots for
+    uint32_t instanceCapacity = 1024;
+
+    // Physics ticks per second, independent of the frame rate
+    uint32_t physicsRate      = 150;
+
+    // More than one runs Bullet's multithreaded world on that many threads
+    uint32_t physicsThreads   = 1;
+
+    // Single threaded physics, replays check every tick against the
+    // state hashes of the recording
+    bool     deterministic    = true;
+
+    // Stress scene, extra instances in a generated field
+    uint32_t stressCount      = 0;
+    uint32_t stressSeed       = 1;
+    bool     profilingEnabled = false;
+
     static Config readFromFile(std::string filename);
 
 
@@ -277,7 +277,8 @@ VkResult createDescriptorSetLayout(const VkDevice device, VkDescriptorSetLayout
 }
 
 VkResult createPipelineLayout(const VkDevice device, const VkDescriptorSetLayout *descriptorSetLayout,
-                              VkPipelineLayout *pipelineLayout) {
+                              VkPipelineLayout *pipelineLayout,
+                              const std::vector<VkPushConstantRange> &pushConstantRanges) {
 
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo;
     pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -285,8 +286,8 @@ VkResult createPipelineLayout(const VkDevice device, const VkDescriptorSetLayout
     pipelineLayoutCreateInfo.flags = 0;
     pipelineLayoutCreateInfo.setLayoutCount = 1;
     pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayout;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = (uint32_t)pushConstantRanges.size();
+    pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
 
     return vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, pipelineLayout);
 }
@@ -520,7 +521,8 @@ VkResult createDescriptorPool(const VkDevice device,
                               VkDescriptorPool *descriptorPool,
                               uint32_t uniformCount,
                               uint32_t dynamicUniformCount,
-                              uint32_t samplerCount) {
+                              uint32_t samplerCount,
+                              uint32_t storageCount) {
 
     VkDescriptorPoolSize uniformDescriptorPoolSize;
     uniformDescriptorPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -534,10 +536,15 @@ VkResult createDescriptorPool(const VkDevice device,
     samplerDescriptorPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     samplerDescriptorPoolSize.descriptorCount = samplerCount;
 
-    std::array<VkDescriptorPoolSize, 3> descriptorPoolSizes = {
+    VkDescriptorPoolSize storageDescriptorPoolSize;
+    storageDescriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    storageDescriptorPoolSize.descriptorCount = storageCount;
+
+    std::array<VkDescriptorPoolSize, 4> descriptorPoolSizes = {
             uniformDescriptorPoolSize,
             dynamicUniformDescriptorPoolSize,
-            samplerDescriptorPoolSize
+            samplerDescriptorPoolSize,
+            storageDescriptorPoolSize
     };
 
 
@@ -545,7 +552,7 @@ VkResult createDescriptorPool(const VkDevice device,
     descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptorPoolCreateInfo.pNext = nullptr;
     descriptorPoolCreateInfo.flags = 0;
-    descriptorPoolCreateInfo.maxSets = uniformCount + dynamicUniformCount + samplerCount;
+    descriptorPoolCreateInfo.maxSets = uniformCount + dynamicUniformCount + samplerCount + storageCount;
     descriptorPoolCreateInfo.poolSizeCount = (uint32_t)descriptorPoolSizes.size();
     descriptorPoolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
 
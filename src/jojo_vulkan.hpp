@@ -51,7 +51,8 @@ VkResult createRenderpass(const VkDevice device, VkRenderPass *renderPass, const
 VkResult createDescriptorSetLayout(const VkDevice device, VkDescriptorSetLayout *descriptorSetLayout);
 
 VkResult createPipelineLayout(const VkDevice device, const VkDescriptorSetLayout *descriptorSetLayout,
-                              VkPipelineLayout *pipelineLayout);
+                              VkPipelineLayout *pipelineLayout,
+                              const std::vector<VkPushConstantRange> &pushConstantRanges = {});
 
 VkResult createPipeline (
     const VkDevice                          device,
@@ -91,7 +92,8 @@ VkResult createDescriptorPool(const VkDevice device,
                               VkDescriptorPool *descriptorPool,
                               uint32_t uniformCount,
                               uint32_t dynamicUniformCount,
-                              uint32_t samplerCount);
+                              uint32_t samplerCount,
+                              uint32_t storageCount);
 
 VkResult allocateDescriptorSet(const VkDevice device, const VkDescriptorPool descriptorPool,
                                const VkDescriptorSetLayout descriptorSetLayout,
@@ -1,6 +1,8 @@
 //
 // Created by benja on 4/28/2018.
 //
+#include <algorithm>
+
 #include "jojo_vulkan_data.hpp"
 #include "jojo_vulkan_utils.hpp"
 #include "jojo_vulkan_textures.hpp"
@@ -20,20 +22,21 @@ VkVertexInputBindingDescription JojoVulkanMesh::getVertexInputBindingDescription
 }
 
 std::vector<VkVertexInputAttributeDescription> JojoVulkanMesh::getVertexInputAttributeDescriptions() {
+    // Quantized, the shaders read the first three components as floats
     std::vector<VkVertexInputAttributeDescription> attr(3);
     attr[0].location = 0;
     attr[0].binding = 0;
-    attr[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attr[0].format = VK_FORMAT_R16G16B16A16_SNORM;
     attr[0].offset = offsetof(Object::Vertex, pos);
 
     attr[1].location = 1;
     attr[1].binding = 0;
-    attr[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attr[1].format = VK_FORMAT_R8G8B8A8_SNORM;
     attr[1].offset = offsetof(Object::Vertex, nml);
 
     attr[2].location = 2;
     attr[2].binding = 0; 
-    attr[2].format = VK_FORMAT_R32G32_SFLOAT;
+    attr[2].format = VK_FORMAT_R16G16_SFLOAT;
     attr[2].offset = offsetof (Object::Vertex, tex);
 
     return attr;
@@ -42,37 +45,34 @@ std::vector<VkVertexInputAttributeDescription> JojoVulkanMesh::getVertexInputAtt
 void JojoVulkanMesh::initializeBuffers(JojoEngine *engine, Rendering::Set set) {
     VkBufferCreateInfo binfo              = {};
     VmaAllocationCreateInfo allocInfo     = {};
-    VkPhysicalDeviceProperties properties = {};
     auto allocator                        = engine->allocator;
 
     // Assign descriptor
     auto descriptors = engine->descriptors;
+    setId         = set;
     descriptorSet = descriptors->set (set);
 
+    // Nothing is uploaded yet
+    textureLayers.fill (0);
+    textureRevisions.fill (0);
+
     // Prepare buffer creation
     binfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     
-    // Find UBO alignment
-    vkGetPhysicalDeviceProperties (engine->chosenDevice, &properties);
-    uint32_t minUboAlignment = (uint32_t)properties.limits.minUniformBufferOffsetAlignment;
-    alignModelTrans          = sizeof (ModelTransformations);
-    alignMaterialInfo        = sizeof (Object::Material);
-    if (minUboAlignment > 0) {
-        alignModelTrans = (alignModelTrans + minUboAlignment - 1)
-            & ~(minUboAlignment - 1);
-        alignMaterialInfo = (alignMaterialInfo + minUboAlignment - 1)
-            & ~(minUboAlignment - 1);
-    }
+    // Transformations are indexed from a storage buffer, no
+    // offset alignment needed anymore
+    alignModelTrans = sizeof (ModelTransformations);
 
     // --------------------------------------------------------------
-    // BUFFER: VERTEX BEGIN
+    // BUFFER: GEOMETRY HEAPS BEGIN
     // --------------------------------------------------------------
 
+    // Sized for the whole heap, models are sub-allocated by the
+    // scene and copied in by cmdUploadModels
     {
-        const auto size = scene->vertices.size () * sizeof (Object::Vertex);
-        allocInfo       = {};
-        
-        binfo.size = size;
+        allocInfo = {};
+
+        binfo.size = scene->vertexHeap.capacity * sizeof (Object::Vertex);
         binfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
             | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
         binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -84,84 +84,32 @@ void JojoVulkanMesh::initializeBuffers(JojoEngine *engine, Rendering::Set set) {
             &vertex, &mem_vertex, nullptr
         ));
 
-        binfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
-
-        ASSERT_VULKAN (vmaCreateBuffer (
-            allocator, &binfo, &allocInfo,
-            &stage_vertex, &mems_vertex, nullptr
-        ));
-
-        Object::Vertex *vertexData;
-        vmaMapMemory (allocator, mems_vertex, (void **)&vertexData);
-        std::copy (
-            scene->vertices.begin (),
-            scene->vertices.end (),
-            vertexData
-        );
-        vmaUnmapMemory (allocator, mems_vertex);
-    }
-
-    // --------------------------------------------------------------
-    // BUFFER: VERTEX END
-    // --------------------------------------------------------------
-
-    // --------------------------------------------------------------
-    // BUFFER: INDEX BEGIN
-    // --------------------------------------------------------------
-
-    {
-        const auto size = scene->indices.size () * sizeof (uint32_t);
-        allocInfo = {};
-
-        binfo.size = size;
+        binfo.size = scene->indexHeap.capacity * sizeof (uint32_t);
         binfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT
             | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
         ASSERT_VULKAN (vmaCreateBuffer (
             allocator, &binfo, &allocInfo,
             &index, &mem_index, nullptr
         ));
-
-        binfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
-
-        ASSERT_VULKAN (vmaCreateBuffer (
-            allocator, &binfo, &allocInfo,
-            &stage_index, &mems_index, nullptr
-        ));
-
-        uint32_t *indexData;
-        vmaMapMemory (allocator, mems_index, (void **)&indexData);
-        std::copy (
-            scene->indices.begin (),
-            scene->indices.end (),
-            indexData
-        );
-        vmaUnmapMemory (allocator, mems_index);
     }
 
     // --------------------------------------------------------------
-    // BUFFER: INDEX END
+    // BUFFER: GEOMETRY HEAPS END
     // --------------------------------------------------------------
 
     // --------------------------------------------------------------
     // BUFFER: MATERIAL INFO BEGIN
     // --------------------------------------------------------------
 
+    // Sized for the whole material heap, ranges are copied in by
+    // cmdUploadMaterials
     {
-        const auto size = alignMaterialInfo * sizeof (Object::Material);
+        const auto size = Scene::materialCapacity * sizeof (Object::Material);
         allocInfo = {};
 
         binfo.size = size;
-        binfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+        binfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
             | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
         binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
@@ -172,29 +120,6 @@ void JojoVulkanMesh::initializeBuffers(JojoEngine *engine, Rendering::Set set) {
             &materialInfo, &mem_materialInfo,
             nullptr
         ));
-
-        binfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
-
-        ASSERT_VULKAN (vmaCreateBuffer (
-            allocator, &binfo, &allocInfo,
-            &stage_materialInfo, &mems_materialInfo, nullptr
-        ));
-
-        const auto &materials  = scene->materials;
-        const uint32_t numMats = (uint32_t)materials.size ();
-        uint8_t *materialData;
-        vmaMapMemory (allocator, mems_materialInfo, (void **)&materialData);
-        for (uint32_t i = 0; i < numMats; i++) {
-            auto m = (Object::Material *)(
-                materialData + alignMaterialInfo * i
-            );
-
-            *m = materials[i];
-        }
-        vmaUnmapMemory (allocator, mems_materialInfo);
     }
 
     // --------------------------------------------------------------
@@ -245,11 +170,11 @@ void JojoVulkanMesh::initializeBuffers(JojoEngine *engine, Rendering::Set set) {
     // --------------------------------------------------------------
 
     {
-        const auto size = alignModelTrans * scene->nextDynTrans;
+        const auto size = alignModelTrans * scene->transHeap.capacity;
         allocInfo = {};
 
         binfo.size = size;
-        binfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+        binfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
             | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
         binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
@@ -366,13 +291,13 @@ void JojoVulkanMesh::initializeBuffers(JojoEngine *engine, Rendering::Set set) {
 
     info = {};
     info.buffer = modelTrans;
-    info.range = sizeof (ModelTransformations);
-    descriptors->update (set, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, info);
+    info.range = VK_WHOLE_SIZE;
+    descriptors->update (set, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, info);
 
     info = {};
     info.buffer = materialInfo;
-    info.range = sizeof (Object::Material);
-    descriptors->update (set, 2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, info);
+    info.range = VK_WHOLE_SIZE;
+    descriptors->update (set, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, info);
 }
 
 void JojoVulkanMesh::destroyBuffers (
@@ -380,48 +305,285 @@ void JojoVulkanMesh::destroyBuffers (
 ) {
     auto allocator = engine->allocator;
 
-    Textures::freeTexture (allocator, engine->device, &textures);
+    for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+        if (textureLayers[b] > 0)
+            Textures::freeTexture (allocator, engine->device, &textures[b]);
+    }
     vmaDestroyBuffer (allocator, stage_globalTrans, mems_globalTrans);
     vmaDestroyBuffer (allocator, globalTrans, mem_globalTrans);
     vmaDestroyBuffer (allocator, stage_modelTrans, mems_modelTrans);
     vmaDestroyBuffer (allocator, modelTrans, mem_modelTrans);
     vmaDestroyBuffer (allocator, stage_lightInfo, mems_lightInfo);
     vmaDestroyBuffer (allocator, lightInfo, mem_lightInfo);
-    vmaDestroyBuffer (allocator, stage_materialInfo, mems_materialInfo);
     vmaDestroyBuffer (allocator, materialInfo, mem_materialInfo);
-    vmaDestroyBuffer (allocator, stage_index, mems_index);
     vmaDestroyBuffer (allocator, index, mem_index);
-    vmaDestroyBuffer (allocator, stage_vertex, mems_vertex);
     vmaDestroyBuffer (allocator, vertex, mem_vertex);
+
+    for (auto &staging : uploadStaging) {
+        for (auto &buffer : staging)
+            vmaDestroyBuffer (allocator, buffer.first, buffer.second);
+        staging.clear ();
+    }
 }
 
-void JojoVulkanMesh::drawNode (
-    const VkCommandBuffer   cmd,
-    const VkPipelineLayout  pipelineLayout,
-    const Scene::Node      *node
-) const {
-    for (const auto &primitive : node->primitives) {
-        uint32_t offsets[] = {
-            primitive.dynamicMVP      * alignModelTrans,
-            primitive.dynamicMaterial * alignMaterialInfo
-        };
-
-        vkCmdBindDescriptorSets (
-            cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelineLayout, 0, 1, &descriptorSet,
-            2, offsets
+void JojoVulkanMesh::cmdUploadModels (
+    VmaAllocator         allocator,
+    VkCommandBuffer      cmd,
+    Level::CleanupQueue *cleanupQueue
+) {
+    auto &pending = scene->pendingUploads;
+    if (pending.empty ())
+        return;
+
+    std::vector<VkBufferCopy> vertexCopies;
+    std::vector<VkBufferCopy> indexCopies;
+    VkDeviceSize              stageSize = 0;
+
+    for (const auto m : pending) {
+        const auto  &model = scene->models[m];
+        VkBufferCopy copy  = {};
+
+        copy.srcOffset = stageSize;
+        copy.dstOffset = model.vertexRange.offset * sizeof (Object::Vertex);
+        copy.size      = model.vertices.size () * sizeof (Object::Vertex);
+        stageSize     += copy.size;
+        if (copy.size > 0)
+            vertexCopies.push_back (copy);
+
+        copy.srcOffset = stageSize;
+        copy.dstOffset = model.indexRange.offset * sizeof (uint32_t);
+        copy.size      = model.indices.size () * sizeof (uint32_t);
+        stageSize     += copy.size;
+        if (copy.size > 0)
+            indexCopies.push_back (copy);
+    }
+
+    if (stageSize > 0) {
+        VkBuffer                staging;
+        VmaAllocation           stagingMem;
+        VkBufferCreateInfo      binfo     = {};
+        VmaAllocationCreateInfo allocInfo = {};
+
+        binfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        binfo.size = stageSize;
+        binfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+        ASSERT_VULKAN (vmaCreateBuffer (
+            allocator, &binfo, &allocInfo,
+            &staging, &stagingMem, nullptr
+        ));
+
+        uint8_t *stageData;
+        vmaMapMemory (allocator, stagingMem, (void **)&stageData);
+        for (const auto m : pending) {
+            const auto &model    = scene->models[m];
+            const auto  vertices = (const uint8_t *)model.vertices.data ();
+            const auto  indices  = (const uint8_t *)model.indices.data ();
+
+            stageData = std::copy (
+                vertices,
+                vertices + model.vertices.size () * sizeof (Object::Vertex),
+                stageData
+            );
+            stageData = std::copy (
+                indices,
+                indices + model.indices.size () * sizeof (uint32_t),
+                stageData
+            );
+        }
+        vmaUnmapMemory (allocator, stagingMem);
+
+        // Ranges may have belonged to an evicted model which earlier
+        // frames still draw from
+        vkCmdPipelineBarrier (
+            cmd,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 0, nullptr
         );
 
-        vkCmdDrawIndexed (
-            cmd, primitive.indexCount, 1,
-            primitive.indexOffset,
-            primitive.vertexOffset, 0
+        if (!vertexCopies.empty ()) {
+            vkCmdCopyBuffer (
+                cmd, staging, vertex,
+                (uint32_t)vertexCopies.size (), vertexCopies.data ()
+            );
+        }
+        if (!indexCopies.empty ()) {
+            vkCmdCopyBuffer (
+                cmd, staging, index,
+                (uint32_t)indexCopies.size (), indexCopies.data ()
+            );
+        }
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT
+            | VK_ACCESS_INDEX_READ_BIT;
+
+        vkCmdPipelineBarrier (
+            cmd,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr
         );
+
+        cleanupQueue->emplace_back (staging, stagingMem);
     }
 
-    for (const auto &child : node->children) {
-        drawNode(cmd, pipelineLayout, &child);
+    // The heaps hold the only copy from now on
+    for (const auto m : pending) {
+        auto &model = scene->models[m];
+        std::vector<Object::Vertex> ().swap (model.vertices);
+        std::vector<uint32_t> ().swap (model.indices);
     }
+    pending.clear ();
 }
 
+void JojoVulkanMesh::cmdUploadMaterials (
+    VmaAllocator         allocator,
+    VkCommandBuffer      cmd,
+    Level::CleanupQueue *cleanupQueue
+) {
+    auto &pending = scene->pendingMaterials;
+    if (pending.empty ())
+        return;
+
+    const auto              &materials = scene->materials;
+    std::vector<VkBufferCopy> copies;
+    VkDeviceSize              stageSize = 0;
+
+    for (const auto &range : pending) {
+        VkBufferCopy copy = {};
+
+        copy.srcOffset = stageSize;
+        copy.dstOffset = range.offset * sizeof (Object::Material);
+        copy.size      = range.count * sizeof (Object::Material);
+        stageSize     += copy.size;
+        copies.push_back (copy);
+    }
+
+    VkBuffer                staging;
+    VmaAllocation           stagingMem;
+    VkBufferCreateInfo      binfo     = {};
+    VmaAllocationCreateInfo allocInfo = {};
 
+    binfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    binfo.size = stageSize;
+    binfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    binfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+    ASSERT_VULKAN (vmaCreateBuffer (
+        allocator, &binfo, &allocInfo,
+        &staging, &stagingMem, nullptr
+    ));
+
+    Object::Material *stageData;
+    vmaMapMemory (allocator, stagingMem, (void **)&stageData);
+    for (const auto &range : pending) {
+        stageData = std::copy (
+            materials.begin () + range.offset,
+            materials.begin () + range.offset + range.count,
+            stageData
+        );
+    }
+    vmaUnmapMemory (allocator, stagingMem);
+
+    // Ranges may have belonged to an evicted model which earlier
+    // frames still shade with
+    vkCmdPipelineBarrier (
+        cmd,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, nullptr, 0, nullptr, 0, nullptr
+    );
+
+    vkCmdCopyBuffer (
+        cmd, staging, materialInfo,
+        (uint32_t)copies.size (), copies.data ()
+    );
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier (
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr
+    );
+
+    cleanupQueue->emplace_back (staging, stagingMem);
+    pending.clear ();
+}
+
+bool JojoVulkanMesh::texturesOutdated () const {
+    for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+        const auto &bucket = scene->textures[b];
+        if (bucket.layers != textureLayers[b] || bucket.revision != textureRevisions[b])
+            return true;
+    }
+
+    return false;
+}
+
+void JojoVulkanMesh::cmdUploadTextures (
+    VmaAllocator                      allocator,
+    VkDevice                          device,
+    const Rendering::DescriptorSets  *descriptors,
+    VkCommandBuffer                   cmd,
+    Level::CleanupQueue              *cleanupQueue
+) {
+    if (!texturesOutdated ())
+        return;
+
+    std::vector<VkDescriptorImageInfo> tex (
+        Scene::textureBucketCount
+    );
+    uint32_t fallback = 0;
+
+    // Texture arrays have a fixed layer count and layers reused from
+    // the free list need their mips, changed buckets are uploaded
+    // again as a whole
+    for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+        const auto &bucket = scene->textures[b];
+        if (bucket.layers == 0)
+            continue;
+
+        if (bucket.layers != textureLayers[b] || bucket.revision != textureRevisions[b]) {
+            VkBuffer      staging;
+            VmaAllocation stagingMem;
+
+            if (textureLayers[b] > 0)
+                Textures::freeTexture (allocator, device, &textures[b]);
+
+            Textures::cmdTextureArrayFromData (
+                allocator, device, cmd,
+                bucket, &textures[b],
+                &staging, &stagingMem
+            );
+            cleanupQueue->emplace_back (staging, stagingMem);
+            textureLayers[b]    = bucket.layers;
+            textureRevisions[b] = bucket.revision;
+        }
+
+        tex[b]   = Textures::descriptor (&textures[b]);
+        fallback = b;
+    }
+
+    // Empty buckets are never sampled, but still need
+    // a valid descriptor
+    for (uint32_t b = 0; b < Scene::textureBucketCount; ++b) {
+        if (scene->textures[b].layers == 0)
+            tex[b] = tex[fallback];
+    }
+
+    descriptors->update (setId, 3, tex);
+}
@@ -11,6 +11,7 @@
 
 #include "jojo_scene.hpp"
 #include "jojo_engine.hpp"
+#include "jojo_level.hpp"
 #include "jojo_pipeline.hpp"
 #include "jojo_vulkan_textures.hpp"
 #include "Rendering/DescriptorSets.h"
@@ -63,10 +64,16 @@ public:
         glm::mat4 normalMatrix;
     };
 
+    // Push constants of the dynamic pipeline, indices into the
+    // model transformation and material buffers
+    struct DrawInfo {
+        uint32_t transIndex;
+        uint32_t materialIndex;
+    };
+
     Scene::Scene *scene = nullptr;
 
     uint32_t alignModelTrans;
-    uint32_t alignMaterialInfo;
 
     // Staging always
     VkBuffer lightInfo;
@@ -78,13 +85,12 @@ public:
     VkBuffer stage_globalTrans;
     VkBuffer stage_dofInfo;
 
-    // Staging once
+    // Geometry heaps, staged per model upload
     VkBuffer vertex;
     VkBuffer index;
+
+    // Material buffer, staged per range of written materials
     VkBuffer materialInfo;
-    VkBuffer stage_vertex;
-    VkBuffer stage_index;
-    VkBuffer stage_materialInfo;
 
     // Staging always
     VmaAllocation mem_lightInfo;
@@ -100,16 +106,33 @@ public:
     VmaAllocationInfo alli_globalTrans;
     VmaAllocationInfo alli_dofInfo;
 
-    // Staging once
+    // Geometry heaps
     VmaAllocation mem_vertex;
     VmaAllocation mem_index;
-    VmaAllocation mem_materialInfo;
-    VmaAllocation mems_vertex;
-    VmaAllocation mems_index;
-    VmaAllocation mems_materialInfo;
 
-    Textures::Texture textures;
+    // Material buffer
+    VmaAllocation mem_materialInfo;
 
+    // Staging buffers of model uploads, per swapchain image until its
+    // fence signals again
+    std::vector<Level::CleanupQueue> uploadStaging;
+
+    // Texture arrays with the layer count and revision of the bucket
+    // they were built from, 0 layers for buckets without an array
+    std::array<
+        Textures::Texture,
+        Scene::textureBucketCount
+    >                 textures;
+    std::array<
+        uint32_t,
+        Scene::textureBucketCount
+    >                 textureLayers;
+    std::array<
+        uint32_t,
+        Scene::textureBucketCount
+    >                 textureRevisions;
+
+    Rendering::Set  setId;
     VkDescriptorSet descriptorSet;
 
     JojoVulkanMesh();
@@ -122,13 +145,35 @@ public:
 
     void initializeBuffers(JojoEngine *engine, Rendering::Set set);
 
-    void destroyBuffers(JojoEngine *engine);
+    // Copies the geometry of all pending models into their heap ranges
+    void cmdUploadModels (
+        VmaAllocator         allocator,
+        VkCommandBuffer      cmd,
+        Level::CleanupQueue *cleanupQueue
+    );
+
+    // Copies the pending material ranges into the material buffer
+    void cmdUploadMaterials (
+        VmaAllocator         allocator,
+        VkCommandBuffer      cmd,
+        Level::CleanupQueue *cleanupQueue
+    );
+
+    // Some texture bucket changed since its texture array was built
+    bool texturesOutdated () const;
+
+    // Rebuilds the texture arrays of buckets that changed and writes
+    // their descriptors. Old arrays are freed right away, so
+    // no submitted frame may still use them.
+    void cmdUploadTextures (
+        VmaAllocator                      allocator,
+        VkDevice                          device,
+        const Rendering::DescriptorSets  *descriptors,
+        VkCommandBuffer                   cmd,
+        Level::CleanupQueue              *cleanupQueue
+    );
 
-    void drawNode (
-        const VkCommandBuffer   cmd,
-        const VkPipelineLayout  pipelineLayout,
-        const Scene::Node      *node
-    ) const;
+    void destroyBuffers(JojoEngine *engine);
 };
 
 
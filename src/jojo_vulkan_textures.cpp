@@ -278,6 +278,7 @@ static VkImageView view (
     VkDevice device,
     VkImage image,
     VkFormat format,
+    VkImageViewType viewType,
     uint32_t layers,
     uint32_t mipLevels
 ) {
@@ -285,7 +286,7 @@ static VkImageView view (
     VkImageViewCreateInfo v = {};
     v.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     v.image = image;
-    v.viewType = layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+    v.viewType = viewType;
     v.format = format;
     v.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
     v.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -379,6 +380,7 @@ void fontTexture (
         device,
         outTexture->image,
         VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_VIEW_TYPE_2D,
         1,
         mipLevels
     );
@@ -390,22 +392,23 @@ void cmdTextureArrayFromData (
     const VmaAllocator              allocator,
     const VkDevice                  device,
     const VkCommandBuffer           transferCmd,
-    const std::vector<
-        Scene::TextureData
-    >                              &texData,
-    uint32_t                        numTextures,
-    uint32_t                        width,
-    uint32_t                        height,
+    const Scene::TextureBucket     &bucket,
     Texture                        *outTexture,
     VkBuffer                       *stagingBuffer,
     VmaAllocation                  *stagingMemory
 ) {
-    const uint32_t mipLevels = 10;
+    const uint32_t width = bucket.size;
+    const uint32_t height = bucket.size;
     const uint32_t channels = 4;
     const uint32_t dataOffset = width * height * channels;
-    const uint32_t layers = numTextures;
+    const uint32_t layers = bucket.layers;
     std::vector<VkBufferImageCopy> copy (layers);
 
+    // Full mip chain down to 1x1
+    uint32_t mipLevels = 1;
+    for (uint32_t size = width; size > 1; size >>= 1)
+        mipLevels += 1;
+
     create (
         allocator,
         dataOffset,
@@ -423,7 +426,7 @@ void cmdTextureArrayFromData (
     stage (
         allocator,
         *stagingMemory,
-        texData[0].data(),
+        bucket.data.data (),
         dataOffset * layers
     );
 
@@ -463,6 +466,7 @@ void cmdTextureArrayFromData (
         device,
         outTexture->image,
         VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_VIEW_TYPE_2D_ARRAY,
         layers,
         mipLevels
     );
@@ -573,6 +577,7 @@ void cmdTextureArrayFromList (
         device,
         outTexture->image,
         VK_FORMAT_R8G8B8A8_UNORM,
+        layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D,
         layers,
         mipLevels
     );
@@ -26,12 +26,7 @@ void cmdTextureArrayFromData (
     const VmaAllocator              allocator,
     const VkDevice                  device,
     const VkCommandBuffer           transferCmd,
-    const std::vector<
-        Scene::TextureData
-    >                              &texData,
-    uint32_t                        numTextures,
-    uint32_t                        width,
-    uint32_t                        height,
+    const Scene::TextureBucket     &bucket,
     Texture                        *outTexture,
     VkBuffer                       *stagingBuffer,
     VmaAllocation                  *stagingMemory
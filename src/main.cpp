@@ -1,7 +1,10 @@
 #include <iostream>
 #include <vector>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <mutex>
+#include <thread>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -26,6 +29,9 @@
 #include "jojo_vulkan_textures.hpp"
 #include "jojo_level.hpp"
 #include "jojo_vulkan_pass.hpp"
+#include "Rendering/RenderQueue.h"
+#include "jojo_profile.hpp"
+#include "jojo_stress.hpp"
 
 struct Pipelines {
     JojoPipeline dynamic;
@@ -36,6 +42,30 @@ struct Pipelines {
     JojoPipeline transparent;
     JojoPipeline logluv;
     JojoPipeline hdr;
+
+    // Render queue pipeline ids
+    uint32_t dynamicQueueId;
+};
+
+// Camera clip planes, the depth keys of the render queue are relative
+// to the far plane as well
+const float nearPlane = 0.1f;
+const float farPlane  = 100.0f;
+
+// Shared by the game loop and the physics thread. Input and the camera
+// go to the physics thread under the mutex, instance transforms come
+// back through the lock-free snapshot buffer.
+struct Simulation {
+    std::thread            thread;
+    std::atomic<bool>      running;
+
+    std::mutex             mutex;
+    Replay::State          input;
+    uint32_t               width;
+    uint32_t               height;
+    glm::mat4              viewProjection;
+
+    Scene::SnapshotBuffer  snapshots;
 };
 
 void drawFrame (
@@ -47,8 +77,10 @@ void drawFrame (
     Pass::PassStorage           *passes,
     JojoVulkanMesh              *mesh,
     const Pipelines             *pipelines,
-    const Scene::Scene          *scene,
-    Level::JojoLevel            *level
+    Scene::Scene                *scene,
+    const Scene::Snapshot       &snapshot,
+    Level::JojoLevel            *level,
+    Rendering::RenderQueue      *renderQueue
 ) {
     const auto allocator     = engine->allocator;
     const auto device        = engine->device;
@@ -112,6 +144,23 @@ void drawFrame (
     // BUILD DRAWING QUEUES BEGIN
     // --------------------------------------------------------------
 
+    {
+        Profile::Scope scope (Profile::QueueInstances);
+        const auto globalTrans = (JojoVulkanMesh::GlobalTransformations *)
+            mesh->alli_globalTrans.pMappedData;
+
+        renderQueue->clear ();
+        Scene::queueInstances (
+            scene->templates.data (), snapshot, &scene->lods,
+            mesh->alignModelTrans,
+            (const uint8_t *)mesh->alli_modelTrans.pMappedData,
+            globalTrans->view,
+            std::abs (globalTrans->projection[1][1]), farPlane,
+            pipelines->dynamicQueueId, renderQueue
+        );
+        renderQueue->sort ();
+    }
+
     // --------------------------------------------------------------
     // BUILD DRAWING QUEUES END
     // --------------------------------------------------------------
@@ -177,6 +226,33 @@ void drawFrame (
         result = beginCommandBuffer (transferCmd);
         ASSERT_VULKAN (result);
 
+        // Staging of the last upload with this image is done now
+        {
+            if (mesh->uploadStaging.size () <= imageIndex)
+                mesh->uploadStaging.resize (imageIndex + 1);
+
+            auto &staging = mesh->uploadStaging[imageIndex];
+            for (const auto &pair : staging)
+                vmaDestroyBuffer (allocator, pair.first, pair.second);
+            staging.clear ();
+
+            mesh->cmdUploadModels (allocator, transferCmd, &staging);
+            mesh->cmdUploadMaterials (allocator, transferCmd, &staging);
+
+            // Replacing texture arrays frees images and rewrites
+            // descriptors that frames in flight still use. Only
+            // happens when templates with new textures were loaded.
+            if (mesh->texturesOutdated ()) {
+                result = vkDeviceWaitIdle (device);
+                ASSERT_VULKAN (result);
+
+                mesh->cmdUploadTextures (
+                    allocator, device, engine->descriptors,
+                    transferCmd, &staging
+                );
+            }
+        }
+
         {
             const auto lightInfo = (const JojoVulkanMesh::LightBlock *)
                 mesh->alli_lightInfo.pMappedData;
@@ -361,15 +437,28 @@ void drawFrame (
         // LEVEL DRAWING END
         // --------------------------------------------------------------
 
-        vkCmdBindPipeline (
-            deferredCmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelines->dynamic.pipeline
-        );
-        Scene::cmdDrawInstances (
-            deferredCmd, pipelines->dynamic.pipelineLayout, mesh,
-            scene->templates.data (), scene->instances.data (),
-            scene->numInstances
-        );
+        // --------------------------------------------------------------
+        // DYNAMIC DRAWING BEGIN
+        // --------------------------------------------------------------
+
+        {
+            VkBuffer vertexBuffers[] = { mesh->vertex };
+            VkDeviceSize offsets[] = { 0 };
+            vkCmdBindVertexBuffers (
+                deferredCmd, 0, 1,
+                vertexBuffers, offsets
+            );
+            vkCmdBindIndexBuffer (
+                deferredCmd, mesh->index, 0,
+                VK_INDEX_TYPE_UINT32
+            );
+
+            renderQueue->cmdSubmit (deferredCmd, Rendering::Pass::Opaque);
+        }
+
+        // --------------------------------------------------------------
+        // DYNAMIC DRAWING END
+        // --------------------------------------------------------------
 
         vkCmdEndRenderPass (deferredCmd);
 
@@ -592,17 +681,284 @@ void drawFrame (
 
 auto lastFrameTime = std::chrono::high_resolution_clock::now();
 
+// Ticks between two printed profiles when profiling is enabled
+const uint32_t profileTicks = 300;
+
+
+static void stepPhysics (
+    Physics::Physics            *physics,
+    Scene::Scene                *scene,
+    const float                  tickLength
+) {
+    auto world = physics->world;
+
+    // Despawns from the last tick and its collision callbacks happen
+    // outside the step
+    Scene::flushDespawns (world, scene);
+    Scene::storePreviousTransforms (&scene->instances);
+
+    uint32_t player;
+    if (Scene::lookup (scene->instances, scene->player, &player)) {
+        const auto &origin = scene->instances.body[player]->getWorldTransform ().getOrigin ();
+        Physics::wakeNear (physics, origin, Physics::wakeRadius);
+        Physics::updateLod (physics, origin);
+    }
+
+    // One fixed step, without substeps Bullet does not interpolate the
+    // motion states on its own
+    {
+        Profile::Scope scope (Profile::StepSimulation);
+        world->stepSimulation (tickLength, 0);
+    }
+}
+
+// --------------------------------------------------------------
+// PHYSICS THREAD START
+// --------------------------------------------------------------
+
+static void processCollisions (
+    Replay::Recorder            *replay,
+    Physics::Physics            *physics
+) {
+    // Only touching something new counts, staying in contact with the
+    // portal does not win again every tick
+    int                   collState = 0;
+    Physics::ContactEvent event;
+    while (Queue::pop (&physics->contacts, &event)) {
+        if (event.phase != Physics::ContactStarted)
+            continue;
+        if (event.type == Scene::LethalInstance && collState == 0)
+            collState = 1;
+        else if (event.type == Scene::PortalInstance)
+            collState = 2;
+    }
+
+    if (replay->state() == Replay::RecorderState::Recording) {
+        if (collState == 2)
+            replay->startReplay();
+    } else {
+        if (collState == 1)
+            std::cout << "YOU LOST" << "\n";
+        else if (collState == 2)
+            std::cout << "YOU WON" << "\n";
+    }
+}
+
+static void applyControls (
+    Config                      &config,
+    Replay::Recorder            *replay,
+    Scene::Scene                *scene,
+    const uint32_t               width,
+    const uint32_t               height
+) {
+    btVector3 relativeForce(0, 0, 0);
+
+    int state = replay->getKey(GLFW_KEY_W);
+    if (state == GLFW_PRESS) {
+        relativeForce = relativeForce + btVector3(0, 0, -1);
+    }
+    state = replay->getKey(GLFW_KEY_S);
+    if (state == GLFW_PRESS) {
+        relativeForce = relativeForce + btVector3(0, 0, 1);
+    }
+    state = replay->getKey(GLFW_KEY_A);
+    if (state == GLFW_PRESS) {
+        relativeForce = relativeForce + btVector3(-1, 0, 0);
+    }
+    state = replay->getKey(GLFW_KEY_D);
+    if (state == GLFW_PRESS) {
+        relativeForce = relativeForce + btVector3(1, 0, 0);
+    }
+    state = replay->getKey(GLFW_KEY_R);
+    if (state == GLFW_PRESS) {
+        relativeForce = relativeForce + btVector3(0, 1, 0);
+    }
+    state = replay->getKey(GLFW_KEY_F);
+    if (state == GLFW_PRESS) {
+        relativeForce = relativeForce + btVector3(0, -1, 0);
+    }
+
+    state = replay->getKey(GLFW_KEY_X);
+    bool xPressed = state == GLFW_PRESS;
+
+    state = replay->getKey(GLFW_KEY_Z);
+    bool yPressed = state == GLFW_PRESS;
+
+
+    btVector3 relativeTorque(0, 0, 0);
+
+    state = replay->getKey(GLFW_KEY_Q);
+    if (state == GLFW_PRESS) {
+        relativeTorque = relativeTorque + btVector3(0, 1, 0);
+    }
+    state = replay->getKey(GLFW_KEY_E);
+    if (state == GLFW_PRESS) {
+        relativeTorque = relativeTorque + btVector3(0, -1, 0);
+    }
+
+    double xpos, ypos;
+    replay->getCursorPos(&xpos, &ypos);
+
+    double relXpos = xpos - width / 2.0f;
+    double relYpos = ypos - height / 2.0f;
+
+    double minX = width * config.deadzoneScreenPercentage / 100.0f;
+    double minY = height * config.deadzoneScreenPercentage / 100.0f;
+
+    double maxX = width * config.navigationScreenPercentage / 100.0f;
+    double maxY = height * config.navigationScreenPercentage / 100.0f;
+
+    double absXpos = glm::abs(relXpos);
+    double absYpos = glm::abs(relYpos);
+
+     if (absXpos > minX) {
+         if (absXpos > maxX) {
+             absXpos = maxX;
+         }
+         double torque = (absXpos - minX) / (maxX - minX) * glm::sign(relXpos) * -1;
+         relativeTorque = relativeTorque + btVector3(0, 0, static_cast<float>(torque));
+     } 
+
+     if (absYpos > minY) {
+         if (absYpos > maxY) {
+             absYpos = maxY;
+         }
+         double torque = (absYpos - minY) / (maxY - minY) * glm::sign(relYpos) * -1;
+         relativeTorque = relativeTorque + btVector3(static_cast<float>(torque), 0, 0);
+     }
+
+    uint32_t   player;
+    const auto steering  = !relativeForce.isZero () || !relativeTorque.isZero () || xPressed || yPressed;
+    const auto hasPlayer = Scene::lookup (scene->instances, scene->player, &player);
+
+    if (steering && hasPlayer) {
+        auto body = scene->instances.body[player];
+
+        btTransform trans;
+        body->getMotionState ()->getWorldTransform (trans);
+
+        btMatrix3x3 &boxRot = trans.getBasis ();
+
+        if (xPressed) {
+            if (body->getLinearVelocity ().norm () < 0.01) {
+                // stop the jiggling around
+                body->setLinearVelocity (btVector3 (0, 0, 0));
+            } else {
+                // counteract the current inertia
+                // TODO: think about maybe making halting easier than accelerating.
+                btVector3 correctedForce = (body->getLinearVelocity () * -1).normalized ();
+                body->applyCentralForce (correctedForce);
+            }
+        }
+        if (yPressed) {
+            if (body->getAngularVelocity ().norm () < 0.01) {
+                body->setAngularVelocity (btVector3 (0, 0, 0));
+            } else {
+                btVector3 correctedTorque = (body->getAngularVelocity () * -1).normalized ();
+                body->applyTorque (correctedTorque);
+            }
+        }
+
+        if (!xPressed) {
+            if (!relativeForce.isZero ()) {
+                // TODO: decide about maybe normalizing
+                btVector3 correctedForce = boxRot * relativeForce;
+                body->applyCentralForce (correctedForce);
+            }
+        }
+        if (!yPressed) {
+            if (!relativeTorque.isZero ()) {
+                btVector3 correctedTorque = boxRot * relativeTorque;
+                body->applyTorque (correctedTorque);
+            }
+        }
+    }
+}
+
+static void simulate (
+    Config                      &config,
+    Replay::Recorder            *jojoReplay,
+    Scene::Scene                *scene,
+    Physics::Physics            *physics,
+    Simulation                  *simulation
+) {
+    while (simulation->running.load ()) {
+        Replay::State input;
+        uint32_t      width, height;
+        glm::mat4     viewProjection;
+        {
+            std::lock_guard<std::mutex> lock (simulation->mutex);
+            input          = simulation->input;
+            width          = simulation->width;
+            height         = simulation->height;
+            viewProjection = simulation->viewProjection;
+        }
+
+        // Fixed rate ticks, taken out of the time since the last loop
+        bool ticked = false;
+        while (jojoReplay->nextTickReady()) {
+            processCollisions (jojoReplay, physics);
+
+            jojoReplay->sample (input);
+            if (config.deterministic) {
+                size_t tick;
+                if (jojoReplay->diverged (Physics::stateHash (scene->instances), &tick))
+                    std::cout << "replay diverged from the recording at tick " << tick << "\n";
+            }
+            applyControls (config, jojoReplay, scene, width, height);
+            jojoReplay->nextTick();
+
+            stepPhysics (physics, scene, jojoReplay->tickLength ());
+            ticked = true;
+
+            Profile::endTick ();
+            if (config.profilingEnabled && Profile::ticksSinceReport () >= profileTicks)
+                Profile::report (std::cout);
+        }
+
+        const auto tickLength = jojoReplay->tickLength ();
+        const auto remaining  = (1.0f - jojoReplay->tickAlpha ()) * tickLength;
+
+        if (ticked) {
+            // Culled with the camera of the last rendered frame
+            if (config.cullingEnabled) {
+                Profile::Scope scope (Profile::Culling);
+                Physics::cullInstances (physics, viewProjection);
+            } else {
+                auto &visible = scene->instances.visible;
+                for (uint32_t i = 0; i < scene->instances.count; ++i)
+                    visible[i] = 1;
+            }
+
+            // Back to when the last tick was due, the leftover of the
+            // accumulator has already passed since
+            const auto now  = std::chrono::steady_clock::now ();
+            const auto time = now - std::chrono::duration_cast<std::chrono::steady_clock::duration> (
+                std::chrono::duration<float> (tickLength - remaining)
+            );
+            Scene::publishSnapshot (
+                scene->instances, scene->player,
+                time, tickLength, &simulation->snapshots
+            );
+        }
+
+        std::this_thread::sleep_for (std::chrono::duration<float> (remaining));
+    }
+}
+
+// --------------------------------------------------------------
+// PHYSICS THREAD END
+// --------------------------------------------------------------
 
 static void updateMvp (
     Config                      &config,
     JojoEngine                  *engine,
-    Physics::Physics            *physics,
+    Simulation                  *simulation,
     JojoVulkanMesh              *mesh,
-    const Scene::Scene *scene,
+    Scene::Scene                *scene,
+    const Scene::Snapshot       &snapshot,
     Level::JojoLevel            *level
 ) {
-    auto world = physics->world;
-
     auto now = std::chrono::high_resolution_clock::now();
     float timeSinceLastFrame = std::chrono::duration_cast<std::chrono::milliseconds> (
         now - lastFrameTime
@@ -615,25 +971,37 @@ static void updateMvp (
     glm::mat4 projection = glm::perspective (
         glm::radians(60.0f),
         config.width / (float) config.height,
-        0.1f, 100.0f
+        nearPlane, farPlane
     );
     projection[1][1] *= -1;  // openGL has the z dir flipped
 
+    // How far rendering is past the tick of the snapshot
+    const auto sinceTick = std::chrono::duration<float> (
+        std::chrono::steady_clock::now () - snapshot.time
+    ).count ();
+    const auto alpha = glm::clamp (sinceTick / snapshot.tickLength, 0.0f, 1.0f);
 
-    world->stepSimulation (timeSinceLastFrame);
+    // The model matrix also holds the dequantization, so the camera
+    // takes the body transform directly
+    glm::mat4 playerMatrix (1.0f);
+    if (snapshot.hasPlayer)
+        Scene::interpolatedMatrix (snapshot, snapshot.player, alpha, &playerMatrix);
+    glm::mat4 view = glm::inverse (playerMatrix);
 
-    Scene::updateMatrices (
-        scene->templates.data (), scene->instances.data (),
-        scene->numInstances, mesh->alignModelTrans, true,
-        (uint8_t *)mesh->alli_modelTrans.pMappedData
-    );
+    // The physics thread culls the next snapshot with this camera
+    {
+        std::lock_guard<std::mutex> lock (simulation->mutex);
+        simulation->viewProjection = projection * view;
+    }
 
-    auto &player     = scene->templates[scene->instances[0].templateId].nodes[0];
-    auto playerTrans = (JojoVulkanMesh::ModelTransformations *) (
-        (uint8_t *)mesh->alli_modelTrans.pMappedData
-        + mesh->alignModelTrans * player.dynamicTrans
-    );
-    glm::mat4 view = glm::inverse (playerTrans->model);
+    {
+        Profile::Scope scope (Profile::UpdateMatrices);
+        Scene::updateMatrices (
+            scene->templates.data (), snapshot,
+            mesh->alignModelTrans, true, alpha,
+            (uint8_t *)mesh->alli_modelTrans.pMappedData
+        );
+    }
 
     auto globalTrans = (JojoVulkanMesh::GlobalTransformations *)
         mesh->alli_globalTrans.pMappedData;
@@ -648,7 +1016,7 @@ static void updateMvp (
     lightInfo->parameters.y = config.hdrMode; // HDR enable
     lightInfo->parameters.z = 1.0f;           // HDR exposure
     lightInfo->parameters.w = (float)numlights;
-    lightInfo->playerPos = playerTrans->model * glm::vec4 (0.f, 0.f, 0.f, 1.);
+    lightInfo->playerPos = playerMatrix * glm::vec4 (0.f, 0.f, 0.f, 1.);
 
     auto dofInfo = (Data::DepthOfField *)
         mesh->alli_dofInfo.pMappedData;
@@ -669,192 +1037,97 @@ void gameloop (
     Replay::Recorder            *jojoReplay,
     JojoVulkanMesh              *mesh,
     const Pipelines             *pipelines,
-    const Scene::Scene          *scene,
+    Scene::Scene                *scene,
     Level::JojoLevel            *level,
-    Physics::Physics            *physics
+    Physics::Physics            *physics,
+    Rendering::RenderQueue      *renderQueue
 ) {
     // TODO: extract a bunch of this to JojoWindow
 
     auto window = jojoWindow->window;
-    jojoReplay->startRecording();
 
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-
-        int collState = 0;
-        auto &coll = physics->collisionArray;
-        for (int i = 0; i < coll.size (); i++) {
-            if (!coll[i].active)
-                continue;
-            if (coll[i].obj->type == Scene::LethalInstance) {
-                collState = 1;
-                coll[i].sticky = false;
-                coll[i].active = false;
-                break;
-            } else if (coll[i].obj->type == Scene::PortalInstance) {
-                collState = 2;
-                coll[i].sticky = false;
-                coll[i].active = false;
-                break;
-            }
-        }
-
-        if (jojoReplay->state() == Replay::RecorderState::Recording) {
-            if (collState == 2)
-                jojoReplay->startReplay();
-        } else {
-            if (collState == 1)
-                std::cout << "YOU LOST" << "\n";
-            else if (collState == 2)
-                std::cout << "YOU WON" << "\n";
-        }
-
-        btVector3 relativeForce(0, 0, 0);
-
-        int state = jojoReplay->getKey(GLFW_KEY_W);
-        if (state == GLFW_PRESS) {
-            relativeForce = relativeForce + btVector3(0, 0, -1);
-        }
-        state = jojoReplay->getKey(GLFW_KEY_S);
-        if (state == GLFW_PRESS) {
-            relativeForce = relativeForce + btVector3(0, 0, 1);
-        }
-        state = jojoReplay->getKey(GLFW_KEY_A);
-        if (state == GLFW_PRESS) {
-            relativeForce = relativeForce + btVector3(-1, 0, 0);
-        }
-        state = jojoReplay->getKey(GLFW_KEY_D);
-        if (state == GLFW_PRESS) {
-            relativeForce = relativeForce + btVector3(1, 0, 0);
-        }
-        state = jojoReplay->getKey(GLFW_KEY_R);
-        if (state == GLFW_PRESS) {
-            relativeForce = relativeForce + btVector3(0, 1, 0);
-        }
-        state = jojoReplay->getKey(GLFW_KEY_F);
-        if (state == GLFW_PRESS) {
-            relativeForce = relativeForce + btVector3(0, -1, 0);
-        }
-
-        state = jojoReplay->getKey(GLFW_KEY_X);
-        bool xPressed = state == GLFW_PRESS;
+    // --------------------------------------------------------------
+    // START PHYSICS THREAD BEGIN
+    // --------------------------------------------------------------
 
-        state = jojoReplay->getKey(GLFW_KEY_Z);
-        bool yPressed = state == GLFW_PRESS;
+    Simulation simulation;
+    simulation.input          = {};
+    simulation.width          = config.width;
+    simulation.height         = config.height;
+    simulation.viewProjection = glm::mat4 (1.0f);
+    Scene::initSnapshots (&simulation.snapshots);
 
+    // The first frames have something to draw before the first tick
+    Scene::storePreviousTransforms (&scene->instances);
+    Scene::publishSnapshot (
+        scene->instances, scene->player, std::chrono::steady_clock::now (),
+        jojoReplay->tickLength (), &simulation.snapshots
+    );
 
-        btVector3 relativeTorque(0, 0, 0);
+    jojoReplay->startRecording();
+    simulation.running.store (true);
+    simulation.thread = std::thread (
+        simulate, std::ref (config), jojoReplay, scene, physics, &simulation
+    );
 
-        state = jojoReplay->getKey(GLFW_KEY_Q);
-        if (state == GLFW_PRESS) {
-            relativeTorque = relativeTorque + btVector3(0, 1, 0);
-        }
-        state = jojoReplay->getKey(GLFW_KEY_E);
-        if (state == GLFW_PRESS) {
-            relativeTorque = relativeTorque + btVector3(0, -1, 0);
-        }
+    // --------------------------------------------------------------
+    // START PHYSICS THREAD END
+    // --------------------------------------------------------------
 
-        double xpos, ypos;
-        jojoReplay->getCursorPos(&xpos, &ypos);
+    while (!glfwWindowShouldClose(window)) {
+        glfwPollEvents();
 
-        double relXpos = xpos - config.width / 2.0f;
-        double relYpos = ypos - config.height / 2.0f;
+        Replay::State input;
+        Replay::sampleInput (window, &input);
 
-        double minX = config.width * config.deadzoneScreenPercentage / 100.0f;
-        double minY = config.height * config.deadzoneScreenPercentage / 100.0f;
+        // Keep the cursor within the navigation area, the physics thread
+        // turns its offset from the center into torque
+        double relXpos = input.mouseX - config.width / 2.0f;
+        double relYpos = input.mouseY - config.height / 2.0f;
 
         double maxX = config.width * config.navigationScreenPercentage / 100.0f;
         double maxY = config.height * config.navigationScreenPercentage / 100.0f;
 
-        double absXpos = glm::abs(relXpos);
-        double absYpos = glm::abs(relYpos);
-
-         if (absXpos > minX) {
-             if (absXpos > maxX) {
-                 absXpos = maxX;
-             }
-             double torque = (absXpos - minX) / (maxX - minX) * glm::sign(relXpos) * -1;
-             relativeTorque = relativeTorque + btVector3(0, 0, static_cast<float>(torque));
-         } 
-
-         if (absYpos > minY) {
-             if (absYpos > maxY) {
-                 absYpos = maxY;
-             }
-             double torque = (absYpos - minY) / (maxY - minY) * glm::sign(relYpos) * -1;
-             relativeTorque = relativeTorque + btVector3(static_cast<float>(torque), 0, 0);
-         }
+        double absXpos = glm::min (glm::abs(relXpos), maxX);
+        double absYpos = glm::min (glm::abs(relYpos), maxY);
 
         double newXpos = absXpos * glm::sign(relXpos) + config.width / 2.0f;
         double newYpos = absYpos * glm::sign(relYpos) + config.height / 2.0f;
         glfwSetCursorPos(window, newXpos, newYpos);
 
-        if (jojoReplay->nextTickReady()) {
-            jojoReplay->nextTick();
-
-            if (!relativeForce.isZero () || !relativeTorque.isZero () || xPressed || yPressed) {
-                auto body = scene->instances[0].body;
-
-                btTransform trans;
-                body->getMotionState ()->getWorldTransform (trans);
-
-                btMatrix3x3 &boxRot = trans.getBasis ();
-
-                if (xPressed) {
-                    if (body->getLinearVelocity ().norm () < 0.01) {
-                        // stop the jiggling around
-                        body->setLinearVelocity (btVector3 (0, 0, 0));
-                    } else {
-                        // counteract the current inertia
-                        // TODO: think about maybe making halting easier than accelerating.
-                        btVector3 correctedForce = (body->getLinearVelocity () * -1).normalized ();
-                        body->applyCentralForce (correctedForce);
-                    }
-                }
-                if (yPressed) {
-                    if (body->getAngularVelocity ().norm () < 0.01) {
-                        body->setAngularVelocity (btVector3 (0, 0, 0));
-                    } else {
-                        btVector3 correctedTorque = (body->getAngularVelocity () * -1).normalized ();
-                        body->applyTorque (correctedTorque);
-                    }
-                }
+        {
+            std::lock_guard<std::mutex> lock (simulation.mutex);
+            simulation.input  = input;
+            simulation.width  = config.width;
+            simulation.height = config.height;
+        }
 
-                if (!xPressed) {
-                    if (!relativeForce.isZero ()) {
-                        // TODO: decide about maybe normalizing
-                        btVector3 correctedForce = boxRot * relativeForce;
-                        body->applyCentralForce (correctedForce);
-                    }
-                }
-                if (!yPressed) {
-                    if (!relativeTorque.isZero ()) {
-                        btVector3 correctedTorque = boxRot * relativeTorque;
-                        body->applyTorque (correctedTorque);
-                    }
-                }
-            }
+        // One snapshot for the whole frame, matrices and draws have to
+        // agree on the instances
+        const auto &snapshot = Scene::latestSnapshot (&simulation.snapshots);
 
-            updateMvp (
-                config, engine,
-                physics, mesh, scene, level
-            );
-        }
+        updateMvp (
+            config, engine, &simulation,
+            mesh, scene, snapshot, level
+        );
 
         drawFrame (
             config, engine, jojoWindow, swapchain, jojoReplay,
-            passes, mesh, pipelines, scene, level
+            passes, mesh, pipelines, scene, snapshot, level, renderQueue
         );
     }
+
+    simulation.running.store (false);
+    simulation.thread.join ();
 }
 
 void Rendering::DescriptorSets::createLayouts ()
 {
     std::vector<VkDescriptorSetLayoutBinding> dynamic;
     addLayout (dynamic, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
-    addLayout (dynamic, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT);
-    addLayout (dynamic, 2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_FRAGMENT_BIT);
-    addLayout (dynamic, 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
+    addLayout (dynamic, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
+    addLayout (dynamic, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+    addLayout (dynamic, 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, Scene::textureBucketCount);
     addLayout (dynamic, 4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
     layouts.push_back (createLayout (dynamic));
 
@@ -909,6 +1182,7 @@ int main(int argc, char *argv[]) {
     Scene::Scene scene              = {};
     Pass::PassStorage     passes    = {};
     Pipelines             pipelines = {};
+    Rendering::RenderQueue renderQueue;
 
     // --------------------------------------------------------------
     // ALLOCATE TEXTURE SPACE BEGIN
@@ -917,17 +1191,18 @@ int main(int argc, char *argv[]) {
     {
         uint32_t *tex_ptr;
 
-        scene.textures.resize (64);
-        scene.textureCount = 2;
-
-        tex_ptr = (uint32_t *)scene.textures[0].data ();
+        tex_ptr = (uint32_t *)Scene::allocTexture (
+            512, 512, &scene, &scene.defaultTexture
+        );
         for (int i = 0; i < 512; i++, tex_ptr += 512) {
             for (int j = 0; j < 512; j++) {
                 tex_ptr[j] = -((i ^ j) >> 5 & 1) | 0xFFFF00FF;
             }
         }
 
-        tex_ptr = (uint32_t *)scene.textures[1].data ();
+        tex_ptr = (uint32_t *)Scene::allocTexture (
+            512, 512, &scene, &scene.defaultNormal
+        );
         for (int i = 0; i < 512; i++, tex_ptr += 512) {
             for (int j = 0; j < 512; j++) {
                 tex_ptr[j] = 0xFFFF0000;
@@ -945,19 +1220,24 @@ int main(int argc, char *argv[]) {
 
     {
         const Scene::TemplateInfo templateFiles = {
-            { "ship", { Object::Player }},
-            { "roundcube", { Object::Box }},
-            { "roundcube", { Object::Box }},
-            { "goal", { Object::Box }},
-            { "roundcube", { Object::Box }}
+            { "ship", { Object::Player }, Object::PlayerMaterial },
+            { "roundcube", { Object::Convex }, Object::PropMaterial },
+            { "roundcube", { Object::Convex }, Object::PropMaterial },
+            { "goal", { Object::Box }, Object::GoalMaterial },
+            { "roundcube", { Object::Convex }, Object::PropMaterial }
         };
         const uint32_t numTemplates = (uint32_t) templateFiles.size ();
 
+        Heap::init (Scene::vertexHeapSize, &scene.vertexHeap);
+        Heap::init (Scene::indexHeapSize, &scene.indexHeap);
+        Heap::init (Scene::materialCapacity, &scene.materialHeap);
+
         scene.templates.resize (numTemplates);
         for (uint32_t t = 0; t < numTemplates; ++t) {
             const auto &tfile = templateFiles[t];
             Scene::loadTemplate (
-                tfile.first, tfile.second, t, &scene
+                tfile.model, tfile.collision,
+                tfile.material, t, &scene
             );
         }
     }
@@ -968,15 +1248,24 @@ int main(int argc, char *argv[]) {
 
     Config config = Config::readFromFile("config.ini");
 
+    // --stress <count> adds a generated field of instances and prints
+    // subsystem timings
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string (argv[i]) == "--stress") {
+            config.stressCount      = (uint32_t)std::stoul (argv[i + 1]);
+            config.profilingEnabled = true;
+        }
+    }
+
     JojoWindow window;
     window.startGlfw(config);
 
-    Replay::Recorder jojoReplay(window.window);
+    Replay::Recorder jojoReplay(config.physicsRate);
 
     JojoEngine engine;
     engine.jojoWindow = &window;
     engine.startVulkan();
-    engine.initializeDescriptorPool(100, 100, 100);
+    engine.initializeDescriptorPool(100, 100, 100, 10);
 
     JojoVulkanMesh mesh;
     mesh.scene = &scene;
@@ -1026,71 +1315,56 @@ int main(int argc, char *argv[]) {
     {
         using namespace glm;
 
-        scene.instances.resize (4, {});
-        scene.numInstances = 4;
+        // The generated field comes on top of the configured capacity,
+        // everything spawned later shares what is left
+        Scene::reserveInstances (
+            config.instanceCapacity + config.stressCount, &scene
+        );
 
         // Create player instance
-        Scene::instantiate (
+        scene.player = Scene::instantiate (
             translate(vec3(0.f, 2.5f, 0.f)), 2.0f,
-            0, Scene::PlayerInstance,
-            &scene, &scene.instances[0]
+            0, Scene::PlayerInstance, nullptr, &scene
         );
 
         // Create a few boxes
         Scene::instantiate (
             translate (vec3 (0.f, 2.5f, -10.f)), 0.3f,
-            1, Scene::NonLethalInstance,
-            &scene, &scene.instances[1]
+            1, Scene::NonLethalInstance, nullptr, &scene
         );
         Scene::instantiate (
             translate (vec3 (-1.0f, 3.0f, -6.f)), 0.3f,
-            2, Scene::LethalInstance,
-            &scene, &scene.instances[2]
+            2, Scene::LethalInstance, nullptr, &scene
         );
         Scene::instantiate (
             translate (vec3 (0.f, 2.9f, -17.24f)), 0.0f,
-            3, Scene::PortalInstance,
-            &scene, &scene.instances[3]
+            3, Scene::PortalInstance, nullptr, &scene
         );
 
-        // Create physics world
-        Physics::alloc (&physics);
-        Physics::addInstancesToWorld (
-            &physics, level,
-            scene.instances.data (),
-            scene.numInstances
-        );
-    }
+        if (config.stressCount > 0) {
+            Stress::Field field = {};
+            field.count   = config.stressCount;
+            field.seed    = config.stressSeed;
+            field.origin  = vec3 (0.f, 2.5f, -25.f);
+            field.spacing = 4.f;
 
-    jojoReplay.setResetFunc ([&physics, &scene, level]() {
-        using namespace glm;
+            // Every template except the player and the goal
+            Stress::populate (field, { 1, 2, 4 }, &scene);
+        }
 
-        Physics::removeInstancesFromWorld (
-            &physics, level,
-            scene.instances.data (),
-            scene.numInstances
-        );
-        Physics::free (&physics);
+        // Create physics world, the multithreaded one does not create
+        // its contacts in the same order every run
+        Physics::alloc (config.deterministic ? 1 : config.physicsThreads, &physics);
+        Physics::addInstancesToWorld (&physics, level, &scene.instances);
+    }
 
-        btTransform startTransform;
-        auto t1 = translate (vec3 (0.f, 2.5f, 0.f));
-        auto t2 = translate (vec3 (0.f, 2.5f, -10.f));
-        auto t3 = translate (vec3 (-1.0f, 3.0f, -6.f));
+    // Replays start from the world as it was when recording started
+    Physics::Checkpoint startCheckpoint;
+    Physics::saveCheckpoint (physics, scene.instances, &startCheckpoint);
 
-        
-        startTransform.setFromOpenGLMatrix (value_ptr (t1));
-        scene.instances[0].body->setWorldTransform (startTransform);
-        startTransform.setFromOpenGLMatrix (value_ptr (t2));
-        scene.instances[1].body->setWorldTransform (startTransform);
-        startTransform.setFromOpenGLMatrix (value_ptr (t3));
-        scene.instances[2].body->setWorldTransform (startTransform);
-
-        Physics::alloc (&physics);
-        Physics::addInstancesToWorld (
-            &physics, level,
-            scene.instances.data (),
-            scene.numInstances
-        );
+    jojoReplay.setResetFunc ([&physics, &scene, level, &startCheckpoint]() {
+        Physics::restoreCheckpoint (startCheckpoint, &physics, level, &scene.instances);
+        Scene::storePreviousTransforms (&scene.instances);
     });
 
     // --------------------------------------------------------------
@@ -1108,7 +1382,9 @@ int main(int argc, char *argv[]) {
             engine.descriptors->layout (Rendering::Set::Dynamic),
             (uint32_t)passes.mrtPass.attachments.size () - 1,
             { mesh.getVertexInputBindingDescription () },
-            mesh.getVertexInputAttributeDescriptions ()
+            mesh.getVertexInputAttributeDescriptions (),
+            true, true, false,
+            sizeof (JojoVulkanMesh::DrawInfo)
         );
 
         pipelines.level.createPipelineHelper (
@@ -1196,7 +1472,9 @@ int main(int argc, char *argv[]) {
             engine.descriptors->layout (Rendering::Set::Dynamic),
             (uint32_t)passes.mrtPass.attachments.size () - 1,
             { mesh.getVertexInputBindingDescription () },
-            mesh.getVertexInputAttributeDescriptions ()
+            mesh.getVertexInputAttributeDescriptions (),
+            true, true, false,
+            sizeof (JojoVulkanMesh::DrawInfo)
         );
 
         pipelines.level.destroyPipeline (&engine);
@@ -1318,42 +1596,12 @@ int main(int argc, char *argv[]) {
             );
         }
 
-        {
-            VkBuffer      staging;
-            VmaAllocation stagingMem;
-
-            Textures::cmdTextureArrayFromData (
-                allocator, engine.device, cmd,
-                scene.textures, scene.textureCount,
-                512, 512, &mesh.textures,
-                &staging, &stagingMem
-            );
-
-            auto tex = Textures::descriptor (&mesh.textures);
-            engine.descriptors->update (Rendering::Set::Dynamic, 3, tex);
-
-            levelCleanupQueue.emplace_back (staging, stagingMem);
-        }
-
-        {
-            VkBufferCopy bufferCopy = {};
- 
-            bufferCopy.size = scene.vertices.size() * sizeof (Object::Vertex);
-            vkCmdCopyBuffer (
-                cmd, mesh.stage_vertex, mesh.vertex,
-                1, &bufferCopy
-            );
-            bufferCopy.size = scene.indices.size () * sizeof (uint32_t);
-            vkCmdCopyBuffer (
-                cmd, mesh.stage_index, mesh.index,
-                1, &bufferCopy
-            );
-            bufferCopy.size = scene.materials.size () * mesh.alignMaterialInfo;
-            vkCmdCopyBuffer (
-                cmd, mesh.stage_materialInfo, mesh.materialInfo,
-                1, &bufferCopy
-            );
-        }
+        mesh.cmdUploadTextures (
+            allocator, engine.device, engine.descriptors,
+            cmd, &levelCleanupQueue
+        );
+        mesh.cmdUploadModels (allocator, cmd, &levelCleanupQueue);
+        mesh.cmdUploadMaterials (allocator, cmd, &levelCleanupQueue);
 
         ASSERT_VULKAN (vkEndCommandBuffer (cmd));
 
@@ -1400,9 +1648,14 @@ int main(int argc, char *argv[]) {
     // STAGING ONCE END
     // --------------------------------------------------------------
 
+    pipelines.dynamicQueueId = renderQueue.addPipeline ({
+        &pipelines.dynamic,
+        engine.descriptors->set (Rendering::Set::Dynamic)
+    });
+
     gameloop (
         config, &engine, &window, &swapchain, &passes, &jojoReplay,
-        &mesh, &pipelines, &scene, level, &physics
+        &mesh, &pipelines, &scene, level, &physics, &renderQueue
     );
 
     VkResult result = vkDeviceWaitIdle(engine.device);
@@ -1417,12 +1670,9 @@ int main(int argc, char *argv[]) {
     // --------------------------------------------------------------
 
     {
-        Physics::removeInstancesFromWorld (
-            &physics, level,
-            scene.instances.data (),
-            scene.numInstances
-        );
+        Physics::removeInstancesFromWorld (&physics, level, &scene.instances);
         Physics::free (&physics);
+        Scene::freeInstances (&scene);
     }
 
     // --------------------------------------------------------------
@@ -0,0 +1,46 @@
+//
+// Converts models/<name>.glb into the baked models/<name>.hkm
+//
+#include <iostream>
+#include <string>
+
+#include "jojo_bake.hpp"
+#include "jojo_scene.hpp"
+
+int main (int argc, char *argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: heikousen-bake <model>..." << std::endl;
+        return 1;
+    }
+
+    int result = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string name = argv[i];
+        const auto        path = "models/" + name + ".hkm";
+
+        // The scene holds nothing but this model, so texture layers
+        // and materials start at zero
+        Scene::Scene scene = {};
+        Scene::Model model = {};
+        scene.defaultTexture = Bake::defaultTexture;
+        scene.defaultNormal  = Bake::defaultNormal;
+        Heap::init (Scene::materialCapacity, &scene.materialHeap);
+
+        Object::loadModelFromGLB (name, &model, &scene);
+
+        const auto sourceHash = Bake::hashFile ("models/" + name + ".glb");
+        if (!Bake::writeModel (path, sourceHash, scene, model)) {
+            std::cerr << "could not write " << path << std::endl;
+            result = 1;
+            continue;
+        }
+
+        std::cout << "baked " << path
+                  << ": " << model.vertices.size () << " vertices, "
+                  << model.indices.size () << " indices, "
+                  << model.materialCount << " materials" << std::endl;
+    }
+
+    return result;
+}
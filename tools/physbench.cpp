@@ -0,0 +1,265 @@
+//
+// Steps the physics world of a map headless and prints per-tick timings
+//
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "jojo_level.hpp"
+#include "jojo_physics.hpp"
+#include "jojo_profile.hpp"
+#include "jojo_scene.hpp"
+#include "jojo_stress.hpp"
+
+struct Options {
+    std::string map      = "2";
+    uint32_t    count    = 1000;
+    uint32_t    seed     = 1;
+    uint32_t    ticks    = 3000;
+    uint32_t    rate     = 150;
+    uint32_t    threads  = 1;
+};
+
+static bool parseOptions (
+    int      argc,
+    char    *argv[],
+    Options *options
+) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 == argc)
+            return false;
+
+        const std::string value = argv[++i];
+        if (arg == "--map")
+            options->map = value;
+        else if (arg == "--count")
+            options->count = (uint32_t)std::stoul (value);
+        else if (arg == "--seed")
+            options->seed = (uint32_t)std::stoul (value);
+        else if (arg == "--ticks")
+            options->ticks = std::max ((uint32_t)std::stoul (value), 1u);
+        else if (arg == "--rate")
+            options->rate = std::max ((uint32_t)std::stoul (value), 1u);
+        else if (arg == "--threads")
+            options->threads = std::max ((uint32_t)std::stoul (value), 1u);
+        else
+            return false;
+    }
+
+    return true;
+}
+
+// The player flies a slow weaving pattern, the same on every run
+static void scriptedInput (
+    const uint32_t  tick,
+    btRigidBody    *body
+) {
+    const auto &basis  = body->getWorldTransform ().getBasis ();
+    const auto  phase  = (tick / 150) % 4;
+    const float turn[] = { 0.0f, 0.5f, 0.0f, -0.5f };
+
+    body->applyCentralForce (basis * btVector3 (0, 0, -1));
+    body->applyTorque (basis * btVector3 (0, turn[phase], 0));
+}
+
+static double percentile (
+    const std::vector<double> &sorted,
+    const double               p
+) {
+    const auto index = (size_t)(p * (double)(sorted.size () - 1) + 0.5);
+    return sorted[index];
+}
+
+int main (int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions (argc, argv, &options)) {
+        std::cerr << "usage: heikousen-physbench [--map <name>] [--count <instances>]"
+                  << " [--seed <seed>] [--ticks <ticks>] [--rate <hz>] [--threads <n>]"
+                  << std::endl;
+        return 1;
+    }
+
+    using namespace glm;
+    using Clock = std::chrono::steady_clock;
+
+    Scene::Scene     scene = {};
+    Level::JojoLevel level;
+    Physics::Physics physics;
+
+    // --------------------------------------------------------------
+    // LOADING BEGIN
+    // --------------------------------------------------------------
+
+    level.bsp = BSP::loadBSP ("maps/" + options.map);
+    if (!level.bsp) {
+        std::cerr << "could not load maps/" << options.map << ".bsp" << std::endl;
+        return 1;
+    }
+
+    const auto collidersStart = Clock::now ();
+    Level::loadRigidBodies (&level);
+    const auto collidersTime = std::chrono::duration<double, std::milli> (
+        Clock::now () - collidersStart
+    ).count ();
+
+    // Same templates as the game, textures stay on the CPU. Models only
+    // need the default slots to exist, not their contents.
+    {
+        Scene::allocTexture (512, 512, &scene, &scene.defaultTexture);
+        Scene::allocTexture (512, 512, &scene, &scene.defaultNormal);
+
+        const Scene::TemplateInfo templateFiles = {
+            { "ship", { Object::Player }, Object::PlayerMaterial },
+            { "roundcube", { Object::Convex }, Object::PropMaterial },
+            { "roundcube", { Object::Convex }, Object::PropMaterial },
+            { "goal", { Object::Box }, Object::GoalMaterial },
+            { "roundcube", { Object::Convex }, Object::PropMaterial }
+        };
+        const uint32_t numTemplates = (uint32_t)templateFiles.size ();
+
+        Heap::init (Scene::vertexHeapSize, &scene.vertexHeap);
+        Heap::init (Scene::indexHeapSize, &scene.indexHeap);
+        Heap::init (Scene::materialCapacity, &scene.materialHeap);
+
+        scene.templates.resize (numTemplates);
+        for (uint32_t t = 0; t < numTemplates; ++t) {
+            const auto &tfile = templateFiles[t];
+            Scene::loadTemplate (
+                tfile.model, tfile.collision,
+                tfile.material, t, &scene
+            );
+        }
+    }
+
+    Scene::reserveInstances (options.count + 4, &scene);
+
+    scene.player = Scene::instantiate (
+        translate (vec3 (0.f, 2.5f, 0.f)), 2.0f,
+        0, Scene::PlayerInstance, nullptr, &scene
+    );
+    Scene::instantiate (
+        translate (vec3 (0.f, 2.5f, -10.f)), 0.3f,
+        1, Scene::NonLethalInstance, nullptr, &scene
+    );
+    Scene::instantiate (
+        translate (vec3 (-1.0f, 3.0f, -6.f)), 0.3f,
+        2, Scene::LethalInstance, nullptr, &scene
+    );
+    Scene::instantiate (
+        translate (vec3 (0.f, 2.9f, -17.24f)), 0.0f,
+        3, Scene::PortalInstance, nullptr, &scene
+    );
+
+    {
+        Stress::Field field = {};
+        field.count   = options.count;
+        field.seed    = options.seed;
+        field.origin  = vec3 (0.f, 2.5f, -25.f);
+        field.spacing = 4.f;
+
+        Stress::populate (field, { 1, 2, 4 }, &scene);
+    }
+
+    Physics::alloc (options.threads, &physics);
+    Physics::addInstancesToWorld (&physics, &level, &scene.instances);
+
+    // --------------------------------------------------------------
+    // LOADING END
+    // --------------------------------------------------------------
+
+    // --------------------------------------------------------------
+    // STEPPING BEGIN
+    // --------------------------------------------------------------
+
+    const auto world      = physics.world;
+    const auto pairCache  = world->getBroadphase ()->getOverlappingPairCache ();
+    const auto tickLength = 1.0f / (float)options.rate;
+
+    std::vector<double> tickTimes (options.ticks);
+    uint64_t            pairSum       = 0;
+    uint64_t            manifoldSum   = 0;
+    int                 pairMax       = 0;
+    int                 manifoldMax   = 0;
+    uint64_t            contactEvents = 0;
+    uint64_t            awakeSum      = 0;
+
+    for (uint32_t tick = 0; tick < options.ticks; ++tick) {
+        uint32_t player;
+        bool     hasPlayer = Scene::lookup (scene.instances, scene.player, &player);
+        if (hasPlayer)
+            scriptedInput (tick, scene.instances.body[player]);
+
+        const auto start = Clock::now ();
+        if (hasPlayer) {
+            const auto &origin = scene.instances.body[player]->getWorldTransform ().getOrigin ();
+            Physics::wakeNear (&physics, origin, Physics::wakeRadius);
+            Physics::updateLod (&physics, origin);
+        }
+        {
+            Profile::Scope scope (Profile::StepSimulation);
+            world->stepSimulation (tickLength, 0);
+        }
+        tickTimes[tick] = std::chrono::duration<double, std::milli> (
+            Clock::now () - start
+        ).count ();
+        Profile::endTick ();
+
+        Physics::ContactEvent event;
+        while (Queue::pop (&physics.contacts, &event))
+            contactEvents += 1;
+
+        for (uint32_t i = 0; i < scene.instances.count; ++i)
+            awakeSum += scene.instances.body[i]->isActive () ? 1 : 0;
+
+        const auto pairs     = pairCache->getNumOverlappingPairs ();
+        const auto manifolds = world->getDispatcher ()->getNumManifolds ();
+        pairSum     += pairs;
+        manifoldSum += manifolds;
+        pairMax      = std::max (pairMax, pairs);
+        manifoldMax  = std::max (manifoldMax, manifolds);
+    }
+
+    // --------------------------------------------------------------
+    // STEPPING END
+    // --------------------------------------------------------------
+
+    // --------------------------------------------------------------
+    // REPORT BEGIN
+    // --------------------------------------------------------------
+
+    std::sort (tickTimes.begin (), tickTimes.end ());
+
+    std::cout << std::fixed << std::setprecision (3)
+              << "map " << options.map << ", " << scene.instances.count
+              << " instances, " << level.rigidBodies.size () << " level bodies, "
+              << options.ticks << " ticks at " << options.rate << " Hz on "
+              << options.threads << " threads\n"
+              << "build colliders   " << collidersTime << " ms\n"
+              << "tick ms           p50 " << percentile (tickTimes, 0.50)
+              << "  p90 " << percentile (tickTimes, 0.90)
+              << "  p99 " << percentile (tickTimes, 0.99)
+              << "  max " << tickTimes.back () << "\n"
+              << "broadphase pairs  mean " << (double)pairSum / options.ticks
+              << "  max " << pairMax << "\n"
+              << "manifolds         mean " << (double)manifoldSum / options.ticks
+              << "  max " << manifoldMax << "\n"
+              << "awake instances   mean " << (double)awakeSum / options.ticks << "\n"
+              << "player contacts   " << contactEvents << " events\n"
+              << "final state hash  " << std::hex << Physics::stateHash (scene.instances)
+              << std::dec << "\n";
+    Profile::report (std::cout);
+
+    // --------------------------------------------------------------
+    // REPORT END
+    // --------------------------------------------------------------
+
+    Physics::removeInstancesFromWorld (&physics, &level, &scene.instances);
+    Physics::free (&physics);
+    Scene::freeInstances (&scene);
+
+    return 0;
+}